@@ -4,23 +4,31 @@
 
 typedef enum { PLATFORM_LINUX, PLATFORM_WINDOWS } build_platform_t;
 
-static bool build_main(Cmd *cmd, build_platform_t platform, bool release, const char **exe_out) {
+// Creates build/<platform>/<config> and returns its path
+static const char *build_dir(build_platform_t platform, const char *config) {
   const char *platform_string = (platform == PLATFORM_LINUX) ? "linux" : "windows";
-  const char *release_string = (release) ? "release" : "debug";
 
   if (!mkdir_if_not_exists("build"))
-    return false;
+    return NULL;
 
   const char *platform_build_path =
     temp_sprintf("build/%s", platform_string);
   
   if (!mkdir_if_not_exists(platform_build_path))
-    return false;
+    return NULL;
+
+  const char *config_build_path =
+    temp_sprintf("%s/%s", platform_build_path, config);
+
+  if (!mkdir_if_not_exists(config_build_path))
+    return NULL;
 
-  const char *release_build_path =
-    temp_sprintf("%s/%s", platform_build_path, release_string);
+  return config_build_path;
+}
 
-  if (!mkdir_if_not_exists(release_build_path))
+static bool build_main(Cmd *cmd, build_platform_t platform, bool release, bool stats, const char **exe_out) {
+  const char *release_build_path = build_dir(platform, (release) ? "release" : "debug");
+  if (release_build_path == NULL)
     return false;
 
   const char *exe =
@@ -38,7 +46,34 @@ static bool build_main(Cmd *cmd, build_platform_t platform, bool release, const
   if (release) cmd_append(cmd, "-O2", "-s");
   else cmd_append(cmd, "-Og", "-ggdb");
 
-  if (platform == PLATFORM_LINUX) cmd_append(cmd, "-lpdcurses");
+  // Latency histograms and the stats command, always on in debug builds
+  if (stats || !release) cmd_append(cmd, "-DTAE_STATS");
+
+  if (!cmd_run_sync(*cmd)) return false;
+
+  return true;
+}
+
+// Tools (benchmarks, generators, the validator) are always optimized, debug symbols stay in
+// for profilers
+static bool build_tool(Cmd *cmd, build_platform_t platform, const char *source, const char *name, const char **exe_out) {
+  const char *tools_build_path = build_dir(platform, "tools");
+  if (tools_build_path == NULL)
+    return false;
+
+  const char *exe =
+    temp_sprintf("%s/%s", tools_build_path, name);
+
+  if (exe_out)
+    *exe_out = exe;
+
+  cmd->count = 0;
+
+  cmd_append(cmd, "cc", "-o", exe);
+  cmd_append(cmd, source);
+  cmd_append(cmd, "-Wall", "-Wextra");
+  cmd_append(cmd, "-O2", "-ggdb");
+  cmd_append(cmd, "-lm");
 
   if (!cmd_run_sync(*cmd)) return false;
 
@@ -47,13 +82,24 @@ static bool build_main(Cmd *cmd, build_platform_t platform, bool release, const
 
 static void usage(const char *program) {
   printf("%s [--windows | --linux] <-r> [args]\n", program);
+  printf("%s bench [args]\n", program);
+  printf("%s gen [args]\n", program);
+  printf("%s check [args]\n", program);
   printf("\t--release: Tries to compile with optimizations and without debug "
          "symbols\n");
+  printf("\t--stats: Keeps the latency histograms and the stats command in "
+         "release builds\n");
   printf("\t--linux: Tries to compile for linux with gcc\n");
   printf("\t--windows: Tries to compile for windows with mingw\n");
   printf("\t-r: Tries to run the executable immediately after "
          "building, it passes everything that comes after it to the "
          "executable as arguments\n");
+  printf("\tbench: Builds the benchmark suite and runs it, passing everything "
+         "that comes after it along (--json, --rooms <count>, --filter <name>)\n");
+  printf("\tgen: Builds the adventure generator and runs it, passing everything "
+         "that comes after it along (see `gen --help`)\n");
+  printf("\tcheck: Builds the adventure validator and runs it, passing everything "
+         "that comes after it along ([--strict] <adventure>...)\n");
 }
 
 int main(int argc, char **argv) {
@@ -62,17 +108,22 @@ int main(int argc, char **argv) {
   const char *program = shift_args(&argc, &argv);
 
   bool release = false;
+  bool stats = false;
 #ifdef _WIN32
   build_platform_t platform = PLATFORM_WINDOWS;
 #else
   build_platform_t platform = PLATFORM_LINUX;
 #endif // _WIN32
   bool run_flag = false;
+  const char *tool_source = NULL;
+  const char *tool_name = NULL;
 
   while (argc > 0) {
     const char *subcmd = shift_args(&argc, &argv);
     if (strcmp(subcmd, "--release") == 0)
       release = true;
+    else if (strcmp(subcmd, "--stats") == 0)
+      stats = true;
     else if (strcmp(subcmd, "--linux") == 0)
       platform = PLATFORM_LINUX;
     else if (strcmp(subcmd, "--windows") == 0)
@@ -80,6 +131,18 @@ int main(int argc, char **argv) {
     else if (strcmp(subcmd, "-r") == 0) {
       run_flag = true;
       break;
+    } else if (strcmp(subcmd, "bench") == 0) {
+      tool_source = "src/bench.c";
+      tool_name = "text-adventure-bench";
+      break;
+    } else if (strcmp(subcmd, "gen") == 0) {
+      tool_source = "src/gen.c";
+      tool_name = "ta-gen";
+      break;
+    } else if (strcmp(subcmd, "check") == 0) {
+      tool_source = "src/check.c";
+      tool_name = "ta-check";
+      break;
     } else {
       nob_log(ERROR, "Unknown flag %s", subcmd);
       usage(program);
@@ -91,7 +154,16 @@ int main(int argc, char **argv) {
 
   const char *exe;
 
-  if (!build_main(&cmd, platform, release, &exe)) return 1;
+  if (tool_source != NULL) {
+    if (!build_tool(&cmd, platform, tool_source, tool_name, &exe)) return 1;
+    cmd.count = 0;
+    cmd_append(&cmd, exe);
+    da_append_many(&cmd, argv, argc);
+    if (!cmd_run_sync(cmd)) return 1;
+    return 0;
+  }
+
+  if (!build_main(&cmd, platform, release, stats, &exe)) return 1;
 
   if (run_flag) {
     cmd.count = 0;
@@ -0,0 +1,379 @@
+// Micro benchmarks for the engine, built and run by `./nob bench`.
+// main.c is compiled into this file so every static function is reachable,
+// its allocations are counted through the wrappers below.
+#ifdef __linux__
+// main.c needs it before the first system header
+#define _GNU_SOURCE
+#endif //__linux__
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+static size_t bench_allocs = 0;
+static size_t bench_alloc_bytes = 0;
+
+static void *bench_malloc(size_t size) {
+  bench_allocs++;
+  bench_alloc_bytes += size;
+  return malloc(size);
+}
+
+static void *bench_realloc(void *old, size_t size) {
+  bench_allocs++;
+  bench_alloc_bytes += size;
+  return realloc(old, size);
+}
+
+static void *bench_calloc(size_t count, size_t size) {
+  bench_allocs++;
+  bench_alloc_bytes += count * size;
+  return calloc(count, size);
+}
+
+// These allocate inside libc, every result is one malloc'd string
+static char *bench_realpath(const char *path, char *resolved) {
+  char *result = realpath(path, resolved);
+  if (result != NULL && resolved == NULL) {
+    bench_allocs++;
+    bench_alloc_bytes += strlen(result) + 1;
+  }
+  return result;
+}
+
+static char *bench_strdup(const char *s) {
+  bench_allocs++;
+  bench_alloc_bytes += strlen(s) + 1;
+  return strdup(s);
+}
+
+#define malloc bench_malloc
+#define realloc bench_realloc
+#define calloc bench_calloc
+#define realpath bench_realpath
+#define strdup bench_strdup
+
+// The interactive parts of main.c are left unused here
+#define TAE_NO_MAIN
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#include "main.c"
+#pragma GCC diagnostic pop
+
+#define BENCH_SMALL_ADVENTURE "test.ta"
+#define BENCH_LARGE_NAME "build/bench-large"
+#define BENCH_LARGE_ADVENTURE BENCH_LARGE_NAME".ta"
+#define BENCH_LARGE_COMPILED BENCH_LARGE_NAME".tac"
+#define BENCH_DEFAULT_ROOMS 100000
+#define BENCH_MIN_NANOS 200000000ull
+
+typedef void (bench_fn_t)(size_t iterations);
+
+typedef struct {
+  const char *name;
+  bench_fn_t *fn;
+} bench_t;
+
+typedef struct {
+  const char *name;
+  size_t iterations;
+  double ns_per_op;
+  double allocs_per_op;
+  double bytes_per_op;
+  // Terminal output, only benchmarks that present frames have any
+  double writes_per_op;
+  double written_per_op;
+} bench_result_t;
+
+static session_t bench_session = {0};
+// The large adventure with --compress storage
+static adventure_t bench_compressed = {0};
+
+static void bench_load(const char *filename, bool compiled, size_t iterations) {
+  for (size_t i = 0; i < iterations; ++i) {
+    adventure_t loaded = {0};
+    bool ok = compiled
+      ? read_compiled_adventure_file(filename, &loaded)
+      : read_adventure_file(filename, &loaded);
+    assert(ok && "benchmark adventure must load");
+    free_adventure(&loaded);
+  }
+}
+
+static void bench_load_small(size_t iterations) {
+  bench_load(BENCH_SMALL_ADVENTURE, false, iterations);
+}
+
+static void bench_load_large(size_t iterations) {
+  bench_load(BENCH_LARGE_ADVENTURE, false, iterations);
+}
+
+static void bench_load_large_compiled(size_t iterations) {
+  bench_load(BENCH_LARGE_COMPILED, true, iterations);
+}
+
+// What --lazy does on load, only the index pass over the room names
+static void bench_load_large_lazy(size_t iterations) {
+  for (size_t i = 0; i < iterations; ++i) {
+    adventure_t loaded = {0};
+    bool ok = read_adventure_source(BENCH_LARGE_ADVENTURE, &loaded, true);
+    assert(ok && "benchmark adventure must load");
+    free_adventure(&loaded);
+  }
+}
+
+// `load` of an unchanged file, answered by the adventure cache
+static void bench_load_cached(size_t iterations) {
+  adventure_t *saved = adventure;
+  session_t session = {0};
+  for (size_t i = 0; i < iterations; ++i) {
+    size_t save = temp_save();
+    dispatch_command(&session, SV("load test"));
+    temp_rewind(save);
+  }
+  adventure = saved;
+}
+
+static void bench_dispatch(size_t iterations) {
+  for (size_t i = 0; i < iterations; ++i)
+    dispatch_command(&bench_session, SV("clear"));
+}
+
+static void bench_look(size_t iterations) {
+  for (size_t i = 0; i < iterations; ++i) {
+    size_t save = temp_save();
+    dispatch_command(&bench_session, SV("look south"));
+    temp_rewind(save);
+  }
+}
+
+// Cache misses only, consecutive iterations land in different rooms
+static void bench_describe_compressed(size_t iterations) {
+  size_t rooms = room_count(&bench_compressed);
+  for (size_t i = 0; i < iterations; ++i)
+    room_description(&bench_compressed, (uint32_t)((i * 7919) % rooms));
+}
+
+static void bench_log_append(size_t iterations) {
+  for (size_t i = 0; i < iterations; ++i)
+    log_message(COLOR_YELLOW"You are in a narrow corridor, there are exits to the north and south of you.");
+}
+
+static void bench_frame_compose(size_t iterations) {
+  for (size_t i = 0; i < iterations; ++i)
+    screen_compose();
+}
+
+// Snapshot of a session with a full log, without the write and fsync
+static void bench_save_encode(size_t iterations) {
+  for (size_t i = 0; i < iterations; ++i)
+    save_encode(&bench_session, true);
+}
+
+#ifndef _WIN32
+// One full frame after a new message: compose, diff, scroll and write, with
+// stdout pointed at /dev/null for the duration
+static void bench_frame_present(size_t iterations) {
+  fflush(stdout);
+  int saved = dup(STDOUT_FILENO);
+  int null = open("/dev/null", O_WRONLY);
+  assert(saved >= 0 && null >= 0);
+  dup2(null, STDOUT_FILENO);
+  close(null);
+
+  for (size_t i = 0; i < iterations; ++i) {
+    log_message(COLOR_YELLOW"You are in a narrow corridor, there are exits to the north and south of you.");
+    screen_compose();
+    screen_present();
+  }
+
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+}
+#endif //_WIN32
+
+static const bench_t benches[] = {
+  { "load_small_ta", bench_load_small },
+  { "load_large_ta", bench_load_large },
+  { "load_large_tac", bench_load_large_compiled },
+  { "load_large_lazy", bench_load_large_lazy },
+  { "load_cached", bench_load_cached },
+  { "dispatch", bench_dispatch },
+  { "look", bench_look },
+  { "describe_compressed", bench_describe_compressed },
+  { "log_append", bench_log_append },
+  { "frame_compose", bench_frame_compose },
+  { "save_encode", bench_save_encode },
+#ifndef _WIN32
+  { "frame_present", bench_frame_present },
+#endif //_WIN32
+};
+
+// Doubles the iteration count until one run takes at least BENCH_MIN_NANOS
+static bench_result_t run_bench(const bench_t *bench) {
+  bench->fn(1);
+
+  size_t iterations = 1;
+  for (;;) {
+    size_t allocs = bench_allocs, bytes = bench_alloc_bytes;
+    size_t writes = screen.total_syscalls, written = screen.total_bytes;
+    uint64_t start = monotonic_nanos();
+    bench->fn(iterations);
+    uint64_t elapsed = monotonic_nanos() - start;
+
+    if (elapsed >= BENCH_MIN_NANOS || iterations >= ((size_t)1 << 40)) {
+      return (bench_result_t){
+        .name = bench->name,
+        .iterations = iterations,
+        .ns_per_op = (double)elapsed / iterations,
+        .allocs_per_op = (double)(bench_allocs - allocs) / iterations,
+        .bytes_per_op = (double)(bench_alloc_bytes - bytes) / iterations,
+        .writes_per_op = (double)(screen.total_syscalls - writes) / iterations,
+        .written_per_op = (double)(screen.total_bytes - written) / iterations,
+      };
+    }
+
+    // Aim straight for the target once there is a usable measurement
+    if (elapsed > BENCH_MIN_NANOS / 100) {
+      size_t next = (size_t)((double)iterations * BENCH_MIN_NANOS / elapsed * 1.1);
+      iterations = next > iterations ? next : iterations * 2;
+    } else {
+      iterations *= 2;
+    }
+  }
+}
+
+#define sb_append_temp(sb, ...)                     \
+  do {                                              \
+    size_t save = temp_save();                      \
+    sb_append_cstr((sb), temp_sprintf(__VA_ARGS__)); \
+    temp_rewind(save);                              \
+  } while (0)
+
+// A square grid of rooms, each connected to its four neighbours
+static bool generate_large_adventure(const char *filename, size_t room_count) {
+  size_t side = 1;
+  while (side * side < room_count) side++;
+
+  String_Builder sb = {0};
+  sb_append_cstr(&sb, "map\nS\npam\nrooms\n");
+  for (size_t i = 0; i < room_count; ++i) {
+    size_t x = i % side, y = i / side;
+    if (i == 0) sb_append_cstr(&sb, "S");
+    else sb_append_temp(&sb, "r%zu", i);
+    sb_append_temp(&sb, "=\"You are in room %zu at %zu,%zu of a synthetic grid, the walls are bare.\"(", i, x, y);
+
+    const char *separator = "";
+    struct { const char *name; size_t target; bool ok; } exits[] = {
+      { "north", i - side, y > 0 },
+      { "east", i + 1, x + 1 < side && i + 1 < room_count },
+      { "south", i + side, i + side < room_count },
+      { "west", i - 1, x > 0 },
+    };
+    for (size_t j = 0; j < ARRAY_LEN(exits); ++j) {
+      if (!exits[j].ok) continue;
+      if (exits[j].target == 0) sb_append_temp(&sb, "%s%s=S", separator, exits[j].name);
+      else sb_append_temp(&sb, "%s%s=r%zu", separator, exits[j].name, exits[j].target);
+      separator = ",";
+    }
+    sb_append_cstr(&sb, ");\n");
+  }
+  sb_append_cstr(&sb, "smoor\n");
+
+  bool result = write_entire_file(filename, sb.items, sb.count);
+  sb_free(sb);
+  return result;
+}
+
+static void print_json(const bench_result_t *results, size_t count, size_t room_count) {
+  printf("{\"large_rooms\":%zu,\"benchmarks\":[", room_count);
+  for (size_t i = 0; i < count; ++i) {
+    printf("%s{\"name\":\"%s\",\"iterations\":%zu,\"ns_per_op\":%.2f,\"allocs_per_op\":%.3f,\"bytes_per_op\":%.1f,"
+           "\"writes_per_op\":%.3f,\"written_per_op\":%.1f}",
+           i > 0 ? "," : "", results[i].name, results[i].iterations,
+           results[i].ns_per_op, results[i].allocs_per_op, results[i].bytes_per_op,
+           results[i].writes_per_op, results[i].written_per_op);
+  }
+  printf("]}\n");
+}
+
+static void print_table(const bench_result_t *results, size_t count) {
+  printf("%-20s %12s %14s %12s %14s %10s %12s\n", "benchmark", "iterations", "ns/op", "allocs/op", "bytes/op",
+         "writes/op", "written/op");
+  for (size_t i = 0; i < count; ++i) {
+    printf("%-20s %12zu %14.1f %12.3f %14.1f %10.3f %12.1f\n", results[i].name, results[i].iterations,
+           results[i].ns_per_op, results[i].allocs_per_op, results[i].bytes_per_op,
+           results[i].writes_per_op, results[i].written_per_op);
+  }
+}
+
+static void usage(const char *program) {
+  fprintf(stderr, "Usage: %s [--json] [--rooms <count>] [--filter <substring>]\n", program);
+  fprintf(stderr, "\t--json: Print the results as one JSON object\n");
+  fprintf(stderr, "\t--rooms: Size of the generated large adventure (default %d)\n", BENCH_DEFAULT_ROOMS);
+  fprintf(stderr, "\t--filter: Only run benchmarks whose name contains <substring>\n");
+}
+
+int main(int argc, char **argv) {
+  const char *program = shift_args(&argc, &argv);
+
+  bool json = false;
+  size_t room_count = BENCH_DEFAULT_ROOMS;
+  const char *filter = NULL;
+  while (argc > 0) {
+    const char *flag = shift_args(&argc, &argv);
+    if (strcmp(flag, "--json") == 0) {
+      json = true;
+    } else if (strcmp(flag, "--rooms") == 0 && argc > 0) {
+      room_count = strtoull(shift_args(&argc, &argv), NULL, 10);
+      if (room_count == 0) room_count = 1;
+    } else if (strcmp(flag, "--filter") == 0 && argc > 0) {
+      filter = shift_args(&argc, &argv);
+    } else {
+      usage(program);
+      return 1;
+    }
+  }
+
+  if (!mkdir_if_not_exists("build")) return 1;
+  if (!generate_large_adventure(BENCH_LARGE_ADVENTURE, room_count)) return 1;
+
+  adventure_t large = {0};
+  if (!read_adventure_file(BENCH_LARGE_ADVENTURE, &large) ||
+      !write_compiled_adventure_file(&large, BENCH_LARGE_COMPILED)) {
+    fprintf(stderr, "Error: could not prepare the large adventure\n");
+    return 1;
+  }
+  free_adventure(&large);
+  if (!read_adventure_file(BENCH_LARGE_ADVENTURE, &bench_compressed)) return 1;
+  compress_descriptions(&bench_compressed);
+  detach_source(&bench_compressed);
+
+  // The session the command benchmarks run against
+  register_builtin_commands();
+  const char *filename;
+  bool cached;
+  if ((adventure = load_adventure(SV(BENCH_LARGE_NAME), &filename, &cached)) == NULL) {
+    fprintf(stderr, "Error: could not load "BENCH_LARGE_NAME"\n");
+    return 1;
+  }
+  bench_session = (session_t){ .adventure_loaded = true, .current_room = adventure->start_room };
+
+  // A full log and a typical terminal for the frame benchmarks
+  screen_resize(120, 40);
+  for (size_t i = 0; i < MESSAGE_LOG_CAPACITY; ++i)
+    log_message(COLOR_YELLOW"You are in a narrow corridor, there are exits to the north and south of you.");
+
+  bench_result_t results[ARRAY_LEN(benches)];
+  size_t result_count = 0;
+  for (size_t i = 0; i < ARRAY_LEN(benches); ++i) {
+    if (filter != NULL && strstr(benches[i].name, filter) == NULL) continue;
+    results[result_count++] = run_bench(&benches[i]);
+  }
+
+  if (json) print_json(results, result_count, room_count);
+  else print_table(results, result_count);
+
+  return 0;
+}
@@ -0,0 +1,67 @@
+// Validates adventures without running them, built and run by `./nob check`.
+// main.c is compiled into this file for its loaders and check_adventure().
+#ifdef __linux__
+// main.c needs it before the first system header
+#define _GNU_SOURCE
+#endif //__linux__
+
+// The interactive parts of main.c are left unused here
+#define TAE_NO_MAIN
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#include "main.c"
+#pragma GCC diagnostic pop
+
+static void usage(const char *program) {
+  fprintf(stderr, "Usage: %s [--strict] <adventure.ta | adventure.tac>...\n", program);
+  fprintf(stderr, "\t--strict: Fail on warnings too, not only on errors\n");
+}
+
+int main(int argc, char **argv) {
+  const char *program = shift_args(&argc, &argv);
+
+  bool strict = false;
+  if (argc > 0 && strcmp(argv[0], "--strict") == 0) {
+    shift_args(&argc, &argv);
+    strict = true;
+  }
+  if (argc == 0) {
+    usage(program);
+    return 1;
+  }
+
+  // Everything, parse errors included, is printed as plain lines
+  String_Builder messages = {0};
+  log_redirect = &messages;
+
+  int status = 0;
+  while (argc > 0) {
+    const char *filename = shift_args(&argc, &argv);
+    adventure_t checked;
+    bool ok = sv_end_with(SV(filename), ".tac")
+      ? read_compiled_adventure_file(filename, &checked)
+      : read_adventure_file(filename, &checked);
+    if (!ok) {
+      printf("%s:\n%.*s", filename, (int)messages.count, messages.items);
+      messages.count = 0;
+      status = 1;
+      continue;
+    }
+
+    uint64_t start = monotonic_nanos();
+    check_result_t result = check_adventure(&checked);
+    uint64_t elapsed = monotonic_nanos() - start;
+
+    printf("%s:\n%.*s", filename, (int)messages.count, messages.items);
+    printf("%zu rooms, %zu exits checked in %.1f ms: %zu errors, %zu warnings\n",
+           room_count(&checked), checked.edge_count, elapsed / 1e6, result.errors, result.warnings);
+    messages.count = 0;
+    if (result.errors > 0 || (strict && result.warnings > 0)) status = 1;
+    free_adventure(&checked);
+  }
+
+  log_redirect = NULL;
+  sb_free(messages);
+  return status;
+}
@@ -0,0 +1,257 @@
+// Writes synthetic .ta adventures for stress tests and benchmarks, built and
+// run by `./nob gen`. Every room draws from its own generator seeded with
+// (seed, room index), so the output only depends on the arguments.
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+#define NOB_IMPLEMENTATION
+#define NOB_STRIP_PREFIX
+#include "nob.h"
+
+typedef enum {
+  DESC_DIST_UNIFORM,
+  DESC_DIST_NORMAL,
+  DESC_DIST_EXP,
+} desc_dist_t;
+
+typedef struct {
+  uint64_t rooms;
+  uint32_t branching;
+  uint32_t desc_min, desc_max;
+  desc_dist_t desc_dist;
+  uint32_t map_width, map_height;
+  uint64_t seed;
+} gen_config_t;
+
+static const char *directions[] = {
+  "north", "east", "south", "west", "up", "down",
+  "northeast", "northwest", "southeast", "southwest",
+};
+#define DIRECTION_COUNT ARRAY_LEN(directions)
+
+static const char *words[] = {
+  "a", "the", "dusty", "narrow", "corridor", "hall", "room", "cellar", "stone",
+  "wooden", "door", "window", "light", "dark", "cold", "damp", "old", "table",
+  "chair", "torch", "flickers", "smells", "of", "moss", "and", "rust", "there",
+  "is", "are", "exits", "to", "you", "see", "hear", "water", "dripping", "far",
+  "away", "somewhere", "below", "above", "quiet", "broken", "lantern", "rug",
+};
+
+// splitmix64, also used to derive per-room states from the seed
+static inline uint64_t rng_next(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+static inline uint64_t rng_below(uint64_t *state, uint64_t bound) {
+  return bound ? rng_next(state) % bound : 0;
+}
+
+// Uniform in (0, 1]
+static inline double rng_unit(uint64_t *state) {
+  return (double)((rng_next(state) >> 11) + 1) / 9007199254740992.0;
+}
+
+static uint64_t rng_for(uint64_t seed, uint64_t stream) {
+  uint64_t state = seed ^ (stream * 0xD1B54A32D192ED03ull);
+  rng_next(&state);
+  return state;
+}
+
+static uint32_t description_length(const gen_config_t *config, uint64_t *rng) {
+  double span = (double)(config->desc_max - config->desc_min);
+  double t = 0.0;
+  switch (config->desc_dist) {
+  case DESC_DIST_UNIFORM:
+    t = rng_unit(rng);
+    break;
+  case DESC_DIST_NORMAL:
+    // Irwin-Hall with four terms is close enough to a bell curve
+    for (int i = 0; i < 4; ++i) t += rng_unit(rng);
+    t /= 4.0;
+    break;
+  case DESC_DIST_EXP:
+    // Mostly short with a long tail, a quarter of the span on average
+    t = -log(rng_unit(rng)) / 4.0;
+    if (t > 1.0) t = 1.0;
+    break;
+  }
+  return config->desc_min + (uint32_t)(t * span);
+}
+
+static void write_room_name(FILE *out, uint64_t room) {
+  if (room == 0) fputc('S', out);
+  else fprintf(out, "r%llu", (unsigned long long)room);
+}
+
+// Rooms form a tree rooted at S with `fanout` children each, every room also
+// links back to its parent, so everything is reachable. The remaining exits up
+// to the branching factor point at random rooms.
+static void write_room(FILE *out, const gen_config_t *config, uint64_t room) {
+  uint64_t rng = rng_for(config->seed, room);
+  uint64_t fanout = config->branching / 2 > 0 ? config->branching / 2 : 1;
+
+  write_room_name(out, room);
+  fputs("=\"", out);
+  uint32_t length = description_length(config, &rng);
+  uint32_t written = 0;
+  while (written < length) {
+    const char *word = words[rng_below(&rng, ARRAY_LEN(words))];
+    size_t n = strlen(word);
+    if (written > 0) {
+      fputc(' ', out);
+      written++;
+    }
+    if (n > length - written) n = length - written;
+    fwrite(word, 1, n, out);
+    written += (uint32_t)n;
+  }
+  fputc('"', out);
+
+  uint64_t targets[DIRECTION_COUNT];
+  size_t count = 0;
+  for (uint64_t i = 1; i <= fanout && count < DIRECTION_COUNT; ++i) {
+    uint64_t child = room * fanout + i;
+    if (child >= config->rooms) break;
+    targets[count++] = child;
+  }
+  if (room > 0 && count < DIRECTION_COUNT) targets[count++] = (room - 1) / fanout;
+  while (count < config->branching && count < DIRECTION_COUNT)
+    targets[count++] = rng_below(&rng, config->rooms);
+
+  if (count > 0) {
+    // Shuffle which direction leads where
+    size_t order[DIRECTION_COUNT];
+    for (size_t i = 0; i < DIRECTION_COUNT; ++i) order[i] = i;
+    for (size_t i = 0; i < count; ++i) {
+      size_t j = i + rng_below(&rng, DIRECTION_COUNT - i);
+      size_t tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+    }
+
+    fputc('(', out);
+    for (size_t i = 0; i < count; ++i) {
+      if (i > 0) fputc(',', out);
+      fputs(directions[order[i]], out);
+      fputc('=', out);
+      write_room_name(out, targets[i]);
+    }
+    fputc(')', out);
+  }
+  fputs(";\n", out);
+}
+
+static void write_map(FILE *out, const gen_config_t *config) {
+  static const char terrain[] = ".#~^";
+  fputs("map\n", out);
+  for (uint32_t y = 0; y < config->map_height; ++y) {
+    uint64_t rng = rng_for(config->seed ^ 0x6D6170ull, y);
+    for (uint32_t x = 0; x < config->map_width; ++x)
+      fputc(terrain[rng_below(&rng, sizeof(terrain) - 1)], out);
+    fputc('\n', out);
+  }
+  fputs("pam\n", out);
+}
+
+static void usage(const char *program) {
+  fprintf(stderr, "Usage: %s [options] [-o <output.ta>]\n", program);
+  fprintf(stderr, "\t--rooms <count>: Number of rooms (default 1000)\n");
+  fprintf(stderr, "\t--branching <exits>: Exits per room, 1 to %zu (default 4)\n", DIRECTION_COUNT);
+  fprintf(stderr, "\t--desc-min <chars>, --desc-max <chars>: Description length range (default 40 to 200)\n");
+  fprintf(stderr, "\t--desc-dist <uniform|normal|exp>: Description length distribution (default normal)\n");
+  fprintf(stderr, "\t--map <width>x<height>: Map size (default 0x0)\n");
+  fprintf(stderr, "\t--seed <seed>: Random seed (default 1)\n");
+  fprintf(stderr, "\t-o <output.ta>: Output file (default stdout)\n");
+}
+
+int main(int argc, char **argv) {
+  const char *program = shift_args(&argc, &argv);
+
+  gen_config_t config = {
+    .rooms = 1000,
+    .branching = 4,
+    .desc_min = 40,
+    .desc_max = 200,
+    .desc_dist = DESC_DIST_NORMAL,
+    .seed = 1,
+  };
+  const char *output = NULL;
+
+  while (argc > 0) {
+    const char *flag = shift_args(&argc, &argv);
+    if (argc == 0) {
+      usage(program);
+      return 1;
+    }
+    const char *value = shift_args(&argc, &argv);
+    if (strcmp(flag, "--rooms") == 0) {
+      config.rooms = strtoull(value, NULL, 10);
+    } else if (strcmp(flag, "--branching") == 0) {
+      config.branching = (uint32_t)strtoul(value, NULL, 10);
+    } else if (strcmp(flag, "--desc-min") == 0) {
+      config.desc_min = (uint32_t)strtoul(value, NULL, 10);
+    } else if (strcmp(flag, "--desc-max") == 0) {
+      config.desc_max = (uint32_t)strtoul(value, NULL, 10);
+    } else if (strcmp(flag, "--desc-dist") == 0) {
+      if (strcmp(value, "uniform") == 0) config.desc_dist = DESC_DIST_UNIFORM;
+      else if (strcmp(value, "normal") == 0) config.desc_dist = DESC_DIST_NORMAL;
+      else if (strcmp(value, "exp") == 0) config.desc_dist = DESC_DIST_EXP;
+      else {
+        usage(program);
+        return 1;
+      }
+    } else if (strcmp(flag, "--map") == 0) {
+      if (sscanf(value, "%ux%u", &config.map_width, &config.map_height) != 2) {
+        usage(program);
+        return 1;
+      }
+    } else if (strcmp(flag, "--seed") == 0) {
+      config.seed = strtoull(value, NULL, 0);
+    } else if (strcmp(flag, "-o") == 0) {
+      output = value;
+    } else {
+      usage(program);
+      return 1;
+    }
+  }
+
+  if (config.rooms == 0 || config.branching == 0 || config.branching > DIRECTION_COUNT ||
+      config.desc_min > config.desc_max) {
+    usage(program);
+    return 1;
+  }
+  if (config.map_width == 0) config.map_height = 0;
+
+  FILE *out = stdout;
+  if (output != NULL) {
+    out = fopen(output, "wb");
+    if (out == NULL) {
+      fprintf(stderr, "Error: could not open %s: %s\n", output, strerror(errno));
+      return 1;
+    }
+  }
+  static char out_buf[1 << 20];
+  setvbuf(out, out_buf, _IOFBF, sizeof(out_buf));
+
+  write_map(out, &config);
+  fputs("rooms\n", out);
+  fprintf(out, "# %llu rooms, branching %u, descriptions %u..%u, seed %llu\n",
+          (unsigned long long)config.rooms, config.branching,
+          config.desc_min, config.desc_max, (unsigned long long)config.seed);
+  for (uint64_t room = 0; room < config.rooms; ++room)
+    write_room(out, &config, room);
+  fputs("smoor\n", out);
+
+  bool ok = fflush(out) == 0 && !ferror(out);
+  if (output != NULL) ok &= fclose(out) == 0;
+  if (!ok) {
+    fprintf(stderr, "Error: could not write the adventure\n");
+    return 1;
+  }
+  return 0;
+}
@@ -1,31 +1,41 @@
+#ifdef __linux__
+// For accept4()
+#define _GNU_SOURCE
+#endif //__linux__
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifdef _WIN32
 #include <windows.h>
 #undef ERROR
+#include <io.h>
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #undef MOUSE_MOVED
 #else
 #include <signal.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <curses.h>
-// Undefine curses.h color definitions
-#undef COLOR_BLACK
-#undef COLOR_RED
-#undef COLOR_GREEN
-#undef COLOR_YELLOW
-#undef COLOR_BLUE
-#undef COLOR_MAGENTA
-#undef COLOR_CYAN
-#undef COLOR_WHITE
-#include <term.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #endif //_WIN32
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif //__linux__
+
 #include <signal.h>
 #include <time.h>
 
@@ -33,6 +43,8 @@
 #define NOB_STRIP_PREFIX
 #include "nob.h"
 
+#define SV(cstr) sv_from_cstr((cstr))
+
 // As it stands, these functions are written very hackily.
 #ifdef _WIN32
 void get_term_size(int *cols, int *rows) {
@@ -46,60 +58,21 @@ void get_term_size(int *cols, int *rows) {
 }
 #else
 void get_term_size(int *cols, int *rows) {
-  char const *const term = getenv("TERM");
-  if (term == NULL) {
-    fprintf(stderr, "TERM environment variable not set\n");
-    return;
-  }
-
-  char const *const cterm_path = ctermid(NULL);
-  if (cterm_path == NULL || cterm_path[0] == '\0') {
-    fprintf(stderr, "ctermid() failed\n");
+  struct winsize size;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == -1) {
+    fprintf(stderr, "ioctl(TIOCGWINSZ) failed (%d): %s\n", errno, strerror(errno));
     return;
   }
+  *cols = size.ws_col;
+  *rows = size.ws_row;
+}
 
-  int tty_fd = open(cterm_path, O_RDWR);
-  if (tty_fd == -1) {
-    fprintf(stderr,
-      "open(\"%s\") failed (%d): %s\n",
-      cterm_path, errno, strerror(errno)
-    );
-    return;
-  }
+// The size is only queried again after the terminal reported a resize
+static volatile sig_atomic_t term_size_changed = 1;
 
-  int setupterm_err;
-  if (setupterm((char*)term, tty_fd, &setupterm_err) == ERR) {
-    switch (setupterm_err) {
-      case -1:
-        fprintf(stderr,
-          "setupterm() failed: terminfo database not found\n"
-        );
-        goto done;
-      case 0:
-        fprintf(stderr,
-          "setupterm() failed: TERM=%s not found in database\n",
-          term
-        );
-        goto done;
-      case 1:
-        fprintf(stderr,
-          "setupterm() failed: terminal is hardcopy\n"
-        );
-        goto done;
-    }
-  }
-
-  *cols = tigetnum((char*)"cols");
-  if (*cols < 0)
-    fprintf(stderr, "tigetnum() failed to get cols (%d)\n", *cols);
-
-  *rows = tigetnum((char*)"lines");
-  if (*rows < 0)
-    fprintf(stderr, "tigetnum() failed to get rows (%d)\n", *rows);
-
-done:
-  if (tty_fd != -1)
-    close(tty_fd);
+static void sigwinch_handler(int _) {
+  (void)_;
+  term_size_changed = 1;
 }
 #endif //_WIN32
 
@@ -123,39 +96,62 @@ done:
 
 #define COLOR_GRAY  ESC"[2;37m"
 
+#define RESET_SCROLL_REGION ESC"[r"
+#define SET_SCROLL_REGION(top, bottom) ESC"[%d;%dr", (top), (bottom)
+#define CLEAR_LINE ESC"[K"
+
 void sig_handler(int _) {
     (void)_;
+    printf(RESET_SCROLL_REGION);
+    printf(COLOR_RESET);
     printf(RESET_CURSOR);
     printf(CLEAR_SCREEN);
     exit(0);
 }
 
-static inline void put_many_char(char c, size_t count) {
-  for (size_t i = 0; i < count; ++i)
-    putchar(c);
-}
-
-static inline void put_many_str(char *s, size_t count) {
-  for (size_t i = 0; i < count; ++i)
-    printf(s);
-}
-
 #define INPUT_BUF_CAP (256 + 1)
 static char input_buf[INPUT_BUF_CAP] = {};
 
 static int cols = -1, rows = -1;
 
+// The log keeps a fixed number of records, their text lives in one byte
+// ring. Positions in the ring only ever grow, `% MESSAGE_LOG_TEXT_CAPACITY`
+// turns them into offsets. A message never wraps around the end of the ring,
+// so every message is one contiguous String_View.
+#define MESSAGE_LOG_CAPACITY 1024
+#define MESSAGE_LOG_TEXT_CAPACITY (64*1024)
+
 typedef struct {
   time_t time;
-  const char *msg;
+  uint64_t position;
+  uint32_t length;
 } message_t;
 
 static struct {
-  message_t *items;
+  message_t items[MESSAGE_LOG_CAPACITY];
+  // Index of the oldest record
+  size_t head;
   size_t count;
-  size_t capacity;
+  // Ring positions of the oldest message's text and of the end of the newest
+  uint64_t text_begin, text_end;
+  char text[MESSAGE_LOG_TEXT_CAPACITY];
 } message_log = {};
 
+// 0 is the oldest message
+static inline const message_t *message_log_at(size_t index) {
+  return &message_log.items[(message_log.head + index) % MESSAGE_LOG_CAPACITY];
+}
+
+static inline String_View message_text(const message_t *message) {
+  return sv_from_parts(message_log.text + message->position % MESSAGE_LOG_TEXT_CAPACITY, message->length);
+}
+
+static inline void message_log_drop_oldest(void) {
+  message_log.head = (message_log.head + 1) % MESSAGE_LOG_CAPACITY;
+  message_log.count--;
+  message_log.text_begin = message_log.count > 0 ? message_log_at(0)->position : message_log.text_end;
+}
+
 #define FORMAT_TIME_BUF_CAP 8
 static inline const char *format_time(time_t time) {
   static char buf[FORMAT_TIME_BUF_CAP] = {};
@@ -164,268 +160,4129 @@ static inline const char *format_time(time_t time) {
   return buf;
 }
 
+// Set in batch and server mode: messages are appended there as plain text
+// lines instead of going into the log
+static String_Builder *log_redirect = NULL;
+
+// Appends `message` followed by a newline with its escape sequences left out
+static void append_plain_line(String_Builder *sb, const char *message, size_t length) {
+  size_t i = 0, start = 0;
+  while (i < length) {
+    if (message[i] != '\x1b') {
+      i++;
+      continue;
+    }
+    if (i > start) sb_append_buf(sb, message + start, i - start);
+    i++;
+    if (i < length && message[i] == '[') {
+      i++;
+      // Parameters and intermediates, then one final byte in 0x40..0x7E
+      while (i < length && (message[i] < 0x40 || message[i] > 0x7E)) i++;
+    }
+    if (i < length) i++;
+    start = i;
+  }
+  // An empty builder has no buffer yet, memcpy() must not see its NULL
+  if (length > start) sb_append_buf(sb, message + start, length - start);
+  da_append(sb, '\n');
+}
+
+// Adds a record to the ring, dropping the oldest ones to make room
+static void message_log_append(const char *message, size_t length, time_t timestamp) {
+  if (length > MESSAGE_LOG_TEXT_CAPACITY) length = MESSAGE_LOG_TEXT_CAPACITY;
+
+  // Skip the tail of the ring when the message would wrap
+  uint64_t position = message_log.text_end;
+  size_t offset = position % MESSAGE_LOG_TEXT_CAPACITY;
+  if (offset + length > MESSAGE_LOG_TEXT_CAPACITY) position += MESSAGE_LOG_TEXT_CAPACITY - offset;
+
+  while (message_log.count > 0 &&
+         (message_log.count == MESSAGE_LOG_CAPACITY ||
+          position + length - message_log.text_begin > MESSAGE_LOG_TEXT_CAPACITY))
+    message_log_drop_oldest();
+
+  memcpy(message_log.text + position % MESSAGE_LOG_TEXT_CAPACITY, message, length);
+  message_log.items[(message_log.head + message_log.count) % MESSAGE_LOG_CAPACITY] = (message_t){
+    .time = timestamp,
+    .position = position,
+    .length = (uint32_t)length,
+  };
+  if (message_log.count == 0) message_log.text_begin = position;
+  message_log.count++;
+  message_log.text_end = position + length;
+}
+
 static inline void log_message(const char *message) {
-  if ((int)message_log.count < rows - 3)
-    da_append(&message_log, ((message_t){time(NULL), strdup(message)}));
-  else {
-      free((char *)message_log.items[0].msg);
-    for (size_t i = 0; i < message_log.count - 1; ++i)
-      message_log.items[i] = message_log.items[i + 1];
-    message_log.items[message_log.count - 1] = ((message_t){time(NULL), strdup(message)});
+  size_t length = strlen(message);
+  if (log_redirect != NULL) {
+    append_plain_line(log_redirect, message, length);
+    return;
   }
+  message_log_append(message, length, time(NULL));
 }
 
 static inline void log_help(void) {
   log_message(COLOR_YELLOW"Type \"load <adventure name>\" to load an <adventure name>.ta file.");
   log_message(COLOR_YELLOW"Then type \"look\" to look around the room, or \"look <direction>\" to look into a nearby room.");
+  log_message(COLOR_YELLOW"Type \"save <name>\" to keep your progress and \"restore <name>\" to return to it.");
 }
 
 static inline void log_clear(void) {
-  for (size_t i = 0; i < message_log.count; ++i)
-    free((char *)message_log.items[i].msg);
+  message_log.head = 0;
   message_log.count = 0;
+  message_log.text_begin = message_log.text_end;
 }
 
+// The screen is composed into `back` every frame and compared against `front`,
+// which mirrors what the terminal currently shows, so only the cells that
+// changed get written. Layout, top to bottom: a ruler, the message log, another
+// ruler and the input line.
 typedef enum {
-  NORTH,
-  EAST,
-  SOUTH,
-  WEST,
-  INVALID_DIRECTION
-} direction_t;
+  CELL_COLOR_DEFAULT,
+  CELL_COLOR_BLACK,
+  CELL_COLOR_RED,
+  CELL_COLOR_GREEN,
+  CELL_COLOR_YELLOW,
+  CELL_COLOR_BLUE,
+  CELL_COLOR_MAGENTA,
+  CELL_COLOR_CYAN,
+  CELL_COLOR_WHITE,
+  CELL_COLOR_GRAY,
+  CELL_COLOR_COUNT,
+} cell_color_t;
 
-typedef struct {
-  const char *description;
-  char connections[4];
-} room_t;
+// Every sequence resets first, so switching away from the dim gray is one sequence
+static const char *cell_color_sequences[CELL_COLOR_COUNT] = {
+  [CELL_COLOR_DEFAULT] = ESC"[0m",
+  [CELL_COLOR_BLACK]   = ESC"[0;30m",
+  [CELL_COLOR_RED]     = ESC"[0;31m",
+  [CELL_COLOR_GREEN]   = ESC"[0;32m",
+  [CELL_COLOR_YELLOW]  = ESC"[0;33m",
+  [CELL_COLOR_BLUE]    = ESC"[0;34m",
+  [CELL_COLOR_MAGENTA] = ESC"[0;35m",
+  [CELL_COLOR_CYAN]    = ESC"[0;36m",
+  [CELL_COLOR_WHITE]   = ESC"[0;37m",
+  [CELL_COLOR_GRAY]    = ESC"[0;2;37m",
+};
 
-#define MAX_MAP_SIZE 5
 typedef struct {
-  char map[MAX_MAP_SIZE][MAX_MAP_SIZE];
-  room_t rooms[256];
-} adventure_t;
+  char ch;
+  uint8_t color;
+} cell_t;
 
-#define SV(cstr) sv_from_cstr((cstr))
-#ifdef _WIN32
-String_View sv_chop_by_newline(String_View *sv) {
-  String_View part = sv_chop_by_delim((sv), '\n');
-  return sv_chop_by_delim(&part, '\r');
+#define BLANK_CELL ((cell_t){ .ch = ' ', .color = CELL_COLOR_DEFAULT })
+
+// Unchanged cells between two changed runs shorter than this are rewritten
+// instead of moving the cursor over them
+#define SCREEN_MAX_SKIPPED_CELLS 6
+
+static struct {
+  int cols, rows;
+  cell_t *front;
+  cell_t *back;
+  // The terminal contents are unknown, clear it and draw everything
+  bool invalid;
+  // -1 when unknown
+  int cursor_x, cursor_y;
+  // CELL_COLOR_COUNT when unknown
+  uint8_t color;
+  // The whole frame is composed here and handed to the terminal in one write
+  String_Builder out;
+  size_t frame_bytes;
+  // write() calls it took to flush the last frame, anything above one means
+  // the terminal accepted a partial write. `stats` reports these.
+  size_t frame_syscalls;
+  size_t frames;
+  size_t total_syscalls;
+  size_t total_bytes;
+} screen = { .invalid = true };
+
+#define SCREEN_LOG_TOP 1
+#define SCREEN_LOG_BOTTOM (screen.rows - 3)
+
+static inline void screen_emit(const char *data, size_t size) {
+  sb_append_buf(&screen.out, data, size);
 }
-#else
-String_View sv_chop_by_newline(String_View *sv) {
-  return sv_chop_by_delim(sv, '\n');
+
+static void screen_emitf(const char *fmt, ...) {
+  char buf[64];
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  if (n > 0) screen_emit(buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
 }
-#endif //_WIN32
-typedef int (chop_predicate_t)(int);
-String_View sv_chop_by_predicate(String_View *sv, chop_predicate_t predicate) {
-    size_t i = 0;
-    while (i < sv->count && !predicate(sv->data[i])) {
-        i += 1;
+
+static void screen_flush(void) {
+  screen.frame_bytes = screen.out.count;
+  screen.frame_syscalls = 0;
+#ifdef _WIN32
+  fwrite(screen.out.items, 1, screen.out.count, stdout);
+  fflush(stdout);
+  screen.frame_syscalls = 1;
+#else
+  size_t written = 0;
+  while (written < screen.out.count) {
+    ssize_t n = write(STDOUT_FILENO, screen.out.items + written, screen.out.count - written);
+    screen.frame_syscalls++;
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      break;
     }
+    written += (size_t)n;
+  }
+#endif //_WIN32
+  screen.frames++;
+  screen.total_syscalls += screen.frame_syscalls;
+  screen.total_bytes += screen.frame_bytes;
+  screen.out.count = 0;
+}
 
-    Nob_String_View result = nob_sv_from_parts(sv->data, i);
+static void screen_resize(int cols, int rows) {
+  if (cols == screen.cols && rows == screen.rows && screen.back != NULL) return;
+  screen.cols = cols > 0 ? cols : 0;
+  screen.rows = rows > 0 ? rows : 0;
+  size_t count = (size_t)screen.cols * screen.rows;
+  free(screen.front);
+  free(screen.back);
+  screen.front = malloc((count ? count : 1) * sizeof(cell_t));
+  screen.back = malloc((count ? count : 1) * sizeof(cell_t));
+  assert(screen.front != NULL && screen.back != NULL && "Buy more RAM lol");
+  screen.invalid = true;
+}
 
-    if (i < sv->count) {
-        sv->count -= i + 1;
-        sv->data  += i + 1;
-    } else {
-        sv->count -= i;
-        sv->data  += i;
-    }
+static inline cell_t *screen_cell(cell_t *cells, int x, int y) {
+  return &cells[(size_t)y * screen.cols + x];
+}
 
-    return result;
+static void screen_fill_row(cell_t *cells, int y, cell_t cell) {
+  for (int x = 0; x < screen.cols; ++x)
+    *screen_cell(cells, x, y) = cell;
 }
 
-direction_t get_direction_index(String_View dir) {
-  if (sv_eq(dir, SV("north"))) return NORTH;
-  if (sv_eq(dir, SV("east"))) return EAST;
-  if (sv_eq(dir, SV("south"))) return SOUTH;
-  if (sv_eq(dir, SV("west"))) return WEST;
-  return INVALID_DIRECTION;
+// Parses an SGR sequence starting at text.data[*i] and advances past it,
+// unknown sequences are skipped without changing `color`
+static void parse_color_sequence(String_View text, size_t *i, uint8_t *color) {
+  size_t start = *i + 2;
+  size_t end = start;
+  while (end < text.count && (isdigit((unsigned char)text.data[end]) || text.data[end] == ';')) end++;
+  *i = end < text.count ? end + 1 : end;
+  if (end >= text.count || text.data[end] != 'm') return;
+
+  String_View params = sv_from_parts(text.data + start, end - start);
+  if (params.count == 0 || sv_eq(params, SV("0"))) *color = CELL_COLOR_DEFAULT;
+  else if (sv_eq(params, SV("2;37"))) *color = CELL_COLOR_GRAY;
+  else if (params.count == 2 && params.data[0] == '3' && params.data[1] >= '0' && params.data[1] <= '7')
+    *color = CELL_COLOR_BLACK + (params.data[1] - '0');
 }
 
-#define error_read(filename) \
-  do { \
-    log_message(temp_sprintf(COLOR_RED"Error %d: could not read adventure file: %s", __LINE__, (filename))); \
-    return_defer(false); \
-  } while (0);
+static size_t text_width(String_View text) {
+  size_t width = 0;
+  uint8_t color = CELL_COLOR_DEFAULT;
+  for (size_t i = 0; i < text.count;) {
+    if (text.data[i] == '\033' && i + 1 < text.count && text.data[i + 1] == '[') {
+      parse_color_sequence(text, &i, &color);
+      continue;
+    }
+    width++;
+    i++;
+  }
+  return width;
+}
 
-#define error_invalid(filename) \
-  do { \
-  log_message(temp_sprintf(COLOR_RED"Error %d: invalid or corrupt adventure file: %s", __LINE__, (filename))); \
-  return_defer(false); \
-  } while (0);
+// Writes `text` into the back buffer starting at (*x, *y), wrapping at the
+// right edge. Cells outside of the log area are skipped but still advance.
+static void screen_put_log_text(int *x, int *y, String_View text, uint8_t color) {
+  for (size_t i = 0; i < text.count;) {
+    char ch = text.data[i];
+    if (ch == '\033' && i + 1 < text.count && text.data[i + 1] == '[') {
+      parse_color_sequence(text, &i, &color);
+      continue;
+    }
+    if ((unsigned char)ch < ' ' || ch == 127) ch = ' ';
+    if (*y >= SCREEN_LOG_TOP && *y <= SCREEN_LOG_BOTTOM)
+      *screen_cell(screen.back, *x, *y) = (cell_t){ .ch = ch, .color = color };
+    i++;
+    if (++*x == screen.cols) {
+      *x = 0;
+      ++*y;
+    }
+  }
+}
 
-static bool read_adventure_file(const char *filename, adventure_t *dest) {
-  size_t save = temp_save();
-  bool result = true;
-  String_Builder source = {};
+static void screen_compose(void) {
+  for (int y = 0; y < screen.rows; ++y)
+    screen_fill_row(screen.back, y, BLANK_CELL);
+  if (screen.rows < 4 || screen.cols < 1) return;
 
-  if (!read_entire_file(filename, &source)) error_read(filename);
+  screen_fill_row(screen.back, 0, (cell_t){ .ch = '=', .color = CELL_COLOR_DEFAULT });
+  screen_fill_row(screen.back, screen.rows - 2, (cell_t){ .ch = '=', .color = CELL_COLOR_DEFAULT });
 
-  String_View view = {
-    .data = source.items,
-    .count = source.count
-  };
-  view = sv_trim(view);
+  // Walk back from the newest message until the log area is full, then lay
+  // them out top down. The oldest one may be cut off at the top.
+  size_t area = (size_t)(SCREEN_LOG_BOTTOM - SCREEN_LOG_TOP + 1);
+  size_t line_count = 0;
+  size_t first = message_log.count;
+  while (first > 0 && line_count < area) {
+    first--;
+    size_t width = sizeof("<00:00> ") - 1 + text_width(message_text(message_log_at(first)));
+    line_count += (width + screen.cols - 1) / screen.cols;
+  }
 
-  String_View line = sv_chop_by_newline(&view);
-  if (!sv_eq(line, SV("map"))) error_invalid(filename);
-  line = sv_chop_by_newline(&view);
+  int y = SCREEN_LOG_TOP - (line_count > area ? (int)(line_count - area) : 0);
+  for (size_t i = first; i < message_log.count; ++i) {
+    const message_t *message = message_log_at(i);
+    int x = 0;
+    screen_put_log_text(&x, &y, SV("<"), CELL_COLOR_GRAY);
+    screen_put_log_text(&x, &y, SV(format_time(message->time)), CELL_COLOR_GRAY);
+    screen_put_log_text(&x, &y, SV(">"), CELL_COLOR_GRAY);
+    screen_put_log_text(&x, &y, SV(" "), CELL_COLOR_DEFAULT);
+    screen_put_log_text(&x, &y, message_text(message), CELL_COLOR_DEFAULT);
+    if (x > 0) y++;
+  }
+}
 
-  bool pam = false;
-  int row = 0;
-  while (line.count > 0) {
-    if (sv_eq(line, SV("pam"))) {
-      pam = true;
-end:
-      line = sv_chop_by_newline(&view);
-      break;
-    }
-    
-    for (size_t i = 0; i < line.count && i <= MAX_MAP_SIZE; ++i) {
-      if (line.data[i] != ' ' && !(line.data[i] == '\n' || line.data[i] == '\r'))
-        dest->map[row][i] = line.data[i];
-    }
-    
-    line = sv_chop_by_newline(&view);
-    row++;
+static void screen_move_cursor(int x, int y) {
+  if (screen.cursor_x == x && screen.cursor_y == y) return;
+  screen_emitf(MOVE_CURSOR(x + 1, y + 1));
+  screen.cursor_x = x;
+  screen.cursor_y = y;
+}
 
-    if (row > MAX_MAP_SIZE) goto end;
+static void screen_set_color(uint8_t color) {
+  if (screen.color == color) return;
+  screen_emit(cell_color_sequences[color], strlen(cell_color_sequences[color]));
+  screen.color = color;
+}
+
+static uint32_t screen_row_hash(const cell_t *cells, int y) {
+  uint32_t hash = 2166136261u;
+  const unsigned char *bytes = (const unsigned char *)screen_cell((cell_t *)cells, 0, y);
+  for (size_t i = 0; i < (size_t)screen.cols * sizeof(cell_t); ++i) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
   }
-  if (!pam) error_invalid(filename);
+  return hash;
+}
 
-  if (!sv_eq(line, SV("rooms"))) error_invalid(filename);
-  line = sv_chop_by_newline(&view);
+// When the log moved up by whole lines, scroll the log area of the terminal
+// the same way so the old lines do not have to be redrawn. The shift is the
+// one under which the most rows of the terminal already match the new frame.
+static void screen_scroll_log(void) {
+  int top = SCREEN_LOG_TOP, bottom = SCREEN_LOG_BOTTOM;
+  int height = bottom - top + 1;
+  if (height < 2) return;
 
-  bool smoor = false;
-  while (line.count > 0) {
-    if (line.data[0] == '#') goto skip;
-    if (sv_eq(line, SV("smoor"))) {
-      smoor = true;
-      line = sv_chop_by_newline(&view);
-      break;
+  uint32_t *front_hashes = temp_alloc(height * sizeof(uint32_t));
+  uint32_t *back_hashes = temp_alloc(height * sizeof(uint32_t));
+  for (int i = 0; i < height; ++i) {
+    front_hashes[i] = screen_row_hash(screen.front, top + i);
+    back_hashes[i] = screen_row_hash(screen.back, top + i);
+  }
+
+  int best_shift = 0, best_matches = 0;
+  for (int n = 0; n < height; ++n) {
+    int matches = 0;
+    for (int i = 0; i + n < height; ++i)
+      matches += front_hashes[i + n] == back_hashes[i];
+    if (matches > best_matches) {
+      best_shift = n;
+      best_matches = matches;
     }
-    if (!sv_end_with(line, ";")) error_invalid(filename);
-    room_t room = {0};
-    char key = line.data[0];
-    if (line.data[1] != '=') error_invalid(filename);
-    if (line.data[2] != '"') error_invalid(filename);
-    sv_chop_by_delim(&line, '"');
-    String_View value = sv_chop_by_delim(&line, '"');
-    room.description = strdup(temp_sv_to_cstr(value));
-    if (line.data[0] == '(') {
-      line.count--;
-      line.data++;
-      if (line.data[0] == ';') error_invalid(filename);
-      while (line.data[0] != ';' && line.count > 1) {
-        direction_t dir = get_direction_index(sv_chop_by_delim(&line, '='));
-        if (dir == INVALID_DIRECTION) error_invalid(filename);
-        char r = line.data[0];
-        line.count--;
-        line.data++;
-        if (!(line.data[0] == ',' || line.data[0] == ')')) error_invalid(filename);
-        room.connections[dir] = r;
-        line.count--;
-        line.data++;
+  }
+  if (best_shift == 0) return;
+
+  // Line feeds at the bottom margin scroll only the log area
+  size_t row = (size_t)screen.cols * sizeof(cell_t);
+  screen_set_color(CELL_COLOR_DEFAULT);
+  screen_move_cursor(0, bottom);
+  for (int i = 0; i < best_shift; ++i) screen_emit("\n", 1);
+  memmove(screen_cell(screen.front, 0, top), screen_cell(screen.front, 0, top + best_shift), (height - best_shift) * row);
+  for (int y = bottom - best_shift + 1; y <= bottom; ++y)
+    screen_fill_row(screen.front, y, BLANK_CELL);
+}
+
+// Writes the difference between the back and the front buffer to the terminal
+// and leaves the cursor at the start of the input line
+static void screen_present(void) {
+  screen.out.count = 0;
+  if (screen.rows < 1 || screen.cols < 1) return;
+
+  if (screen.invalid) {
+    screen_emitf(COLOR_RESET CLEAR_SCREEN);
+    // Keep scrolling confined to the log, this also stops the newline after
+    // the input on the last line from scrolling the whole screen
+    if (screen.rows >= 4) screen_emitf(SET_SCROLL_REGION(SCREEN_LOG_TOP + 1, SCREEN_LOG_BOTTOM + 1));
+    for (int y = 0; y < screen.rows; ++y)
+      screen_fill_row(screen.front, y, BLANK_CELL);
+    screen.cursor_x = screen.cursor_y = -1;
+    screen.color = CELL_COLOR_DEFAULT;
+    screen.invalid = false;
+  } else if (screen.rows >= 4) {
+    screen_scroll_log();
+  }
+
+  for (int y = 0; y < screen.rows - 1; ++y) {
+    int x = 0;
+    while (x < screen.cols) {
+      if (memcmp(screen_cell(screen.front, x, y), screen_cell(screen.back, x, y), sizeof(cell_t)) == 0) {
+        x++;
+        continue;
+      }
+
+      // Extend the run over short stretches of unchanged cells
+      int end = x + 1, last = x;
+      while (end < screen.cols && end - last <= SCREEN_MAX_SKIPPED_CELLS) {
+        if (memcmp(screen_cell(screen.front, end, y), screen_cell(screen.back, end, y), sizeof(cell_t)) != 0)
+          last = end;
+        end++;
       }
+
+      screen_move_cursor(x, y);
+      for (int i = x; i <= last; ++i) {
+        cell_t cell = *screen_cell(screen.back, i, y);
+        screen_set_color(cell.color);
+        screen_emit(&cell.ch, 1);
+        *screen_cell(screen.front, i, y) = cell;
+      }
+      // The cursor is in the pending wrap state after the last column
+      screen.cursor_x = last + 1 < screen.cols ? last + 1 : -1;
+      x = last + 1;
     }
-    if (line.data[0] != ';') error_invalid(filename);
-    dest->rooms[(size_t)key] = room;
-skip:
-    line = sv_chop_by_newline(&view);
   }
-  if (!smoor) error_invalid(filename);
 
-defer:  
-  sb_free(source);
-  temp_rewind(save);
+  // Whatever was typed last time is still echoed on the input line
+  screen_set_color(CELL_COLOR_DEFAULT);
+  screen.cursor_x = screen.cursor_y = -1;
+  screen_move_cursor(0, screen.rows - 1);
+  screen_emitf(CLEAR_LINE);
+  screen.cursor_x = screen.cursor_y = -1;
+  screen_flush();
+}
+
+// Bump allocator for everything that lives exactly as long as one adventure.
+// Nothing is freed individually, arena_free() drops all regions at once.
+#define ARENA_REGION_MIN_CAPACITY (64*1024)
+#define ARENA_DA_INIT_CAP 64
+
+typedef struct arena_region_t arena_region_t;
+struct arena_region_t {
+  arena_region_t *next;
+  size_t count;
+  size_t capacity;
+  char data[];
+};
+
+typedef struct {
+  arena_region_t *begin, *end;
+  // Bytes handed out, alignment padding and blocks left behind by arena_realloc()
+  // included. Since nothing is freed early this is also the high-water mark.
+  size_t used;
+  // Bytes held in regions
+  size_t reserved;
+} arena_t;
+
+#define ARENA_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+static void *arena_alloc(arena_t *arena, size_t size) {
+  size = ARENA_ALIGN(size);
+  if (arena->end == NULL || arena->end->count + size > arena->end->capacity) {
+    // Grow geometrically so the region count stays logarithmic
+    size_t capacity = arena->reserved > ARENA_REGION_MIN_CAPACITY ? arena->reserved : ARENA_REGION_MIN_CAPACITY;
+    if (capacity < size) capacity = size;
+    arena_region_t *region = malloc(sizeof(*region) + capacity);
+    assert(region != NULL && "Buy more RAM lol");
+    region->next = NULL;
+    region->count = 0;
+    region->capacity = capacity;
+    if (arena->end == NULL) arena->begin = region;
+    else arena->end->next = region;
+    arena->end = region;
+    arena->reserved += capacity;
+  }
+
+  void *result = arena->end->data + arena->end->count;
+  arena->end->count += size;
+  arena->used += size;
   return result;
 }
 
-static adventure_t adventure = {};
+// Grows the most recent allocation in place when possible, otherwise copies
+static void *arena_realloc(arena_t *arena, void *old, size_t old_size, size_t new_size) {
+  old_size = ARENA_ALIGN(old_size);
+  new_size = ARENA_ALIGN(new_size);
+  if (new_size <= old_size) return old;
 
-int main(void) {
-#ifdef SIGQUIT
-  signal(SIGQUIT, sig_handler);
-#endif
-  signal(SIGINT, sig_handler);
+  arena_region_t *end = arena->end;
+  if (old != NULL && (char *)old + old_size == end->data + end->count &&
+      end->count - old_size + new_size <= end->capacity) {
+    end->count += new_size - old_size;
+    arena->used += new_size - old_size;
+    return old;
+  }
 
-  bool adventure_loaded = false;
-  char current_room = 'S';
+  void *result = arena_alloc(arena, new_size);
+  if (old != NULL) memcpy(result, old, old_size);
+  return result;
+}
 
-  while (true) {
-    get_term_size(&cols, &rows);
+static void arena_free(arena_t *arena) {
+  arena_region_t *region = arena->begin;
+  while (region != NULL) {
+    arena_region_t *next = region->next;
+    free(region);
+    region = next;
+  }
+  *arena = (arena_t){0};
+}
 
-    printf(RESET_CURSOR);
-    printf(CLEAR_SCREEN);
+// Same as nob_da_append() but for dynamic arrays that live in an arena
+#define arena_da_append(arena, da, item)                                              \
+  do {                                                                                \
+    if ((da)->count >= (da)->capacity) {                                              \
+      size_t new_capacity = (da)->capacity == 0 ? ARENA_DA_INIT_CAP : (da)->capacity*2; \
+      (da)->items = arena_realloc((arena), (da)->items,                               \
+                                  (da)->capacity*sizeof(*(da)->items),                \
+                                  new_capacity*sizeof(*(da)->items));                 \
+      (da)->capacity = new_capacity;                                                  \
+    }                                                                                 \
+    (da)->items[(da)->count++] = (item);                                              \
+  } while (0)
 
-    size_t save = temp_save();
+// A whole file read into memory the process owns. Views into `data` stay
+// valid until free_file_copy() is called, and since it is a copy, later writes
+// to the file can not change or truncate what they show.
+typedef struct {
+  const char *data;
+  size_t size;
+} file_copy_t;
 
-    put_many_char('=', cols);
-    putchar('\n');
+static bool read_file_copy(const char *path, file_copy_t *dest) {
+  *dest = (file_copy_t){0};
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) return false;
 
-    for (size_t i = 0; i < message_log.count; ++i)
-      printf(COLOR_GRAY"<%s>"COLOR_RESET" %s"COLOR_RESET"\n", format_time(message_log.items[i].time), message_log.items[i].msg);
-    
-    printf(MOVE_CURSOR(1, rows - 1));
-    put_many_char('=', cols);
-    
-    putchar('\n');
-    fgets(input_buf, INPUT_BUF_CAP, stdin);
+  char *data = NULL;
+  long size = -1;
+  if (fseek(file, 0, SEEK_END) == 0) size = ftell(file);
+  if (size > 0 && fseek(file, 0, SEEK_SET) == 0) data = malloc((size_t)size);
+  if (data == NULL || fread(data, 1, (size_t)size, file) != (size_t)size) {
+    free(data);
+    fclose(file);
+    return false;
+  }
+  fclose(file);
+
+  dest->data = data;
+  dest->size = (size_t)size;
+  return true;
+}
+
+static void free_file_copy(file_copy_t *file) {
+  free((void *)file->data);
+  *file = (file_copy_t){0};
+}
+
+// nob's rename() logs every call, and files get replaced while serving
+#undef rename
+
+// Moves `temp` over `path` in one step, so readers see either the old file or
+// the new one but never a partly written one
+static bool replace_file(const char *temp, const char *path) {
+#ifdef _WIN32
+  return MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING);
+#else
+  return rename(temp, path) == 0;
+#endif //_WIN32
+}
+
+#define NO_ROOM UINT32_MAX
+#define NO_DIRECTION UINT32_MAX
+
+// A single exit, `direction` indexes the adventure's direction names
+typedef struct {
+  uint32_t direction;
+  uint32_t target;
+} edge_t;
+
+typedef struct {
+  String_View *items;
+  size_t count;
+  size_t capacity;
+} string_views_t;
+
+// Open addressing table from room name to room index, `capacity` is always a
+// power of two and empty slots hold NO_ROOM.
+typedef struct {
+  uint32_t *slots;
+  size_t capacity;
+} room_lookup_t;
+
+// The map is stored as square tiles that are only allocated once a cell in
+// them is set, so memory follows the occupied area rather than the bounds.
+#define MAP_TILE_SIZE 64
+
+typedef struct {
+  uint32_t x, y;
+  char cells[MAP_TILE_SIZE][MAP_TILE_SIZE];
+} map_tile_t;
+
+typedef struct {
+  // Open addressing table of tiles keyed by tile coordinates, NULL when empty
+  const map_tile_t **slots;
+  size_t capacity;
+  size_t count;
+  uint32_t width, height;
+} map_grid_t;
+
+static inline size_t hash_map_tile(uint32_t x, uint32_t y) {
+  return (size_t)(x * 0x9e3779b1u ^ y * 0x85ebca77u);
+}
+
+static const map_tile_t *map_find_tile(const map_grid_t *map, uint32_t x, uint32_t y) {
+  if (map->capacity == 0) return NULL;
+  size_t mask = map->capacity - 1;
+  for (size_t i = hash_map_tile(x, y) & mask;; i = (i + 1) & mask) {
+    const map_tile_t *tile = map->slots[i];
+    if (tile == NULL || (tile->x == x && tile->y == y)) return tile;
+  }
+}
+
+static void map_insert_tile(arena_t *arena, map_grid_t *map, const map_tile_t *tile) {
+  // Keep the load factor at or below 1/2
+  if ((map->count + 1) * 2 > map->capacity) {
+    map_grid_t grown = *map;
+    grown.capacity = map->capacity ? map->capacity * 2 : 16;
+    grown.slots = arena_alloc(arena, grown.capacity * sizeof(*grown.slots));
+    memset(grown.slots, 0, grown.capacity * sizeof(*grown.slots));
+    grown.count = 0;
+    for (size_t i = 0; i < map->capacity; ++i)
+      if (map->slots[i] != NULL) map_insert_tile(arena, &grown, map->slots[i]);
+    *map = grown;
+  }
+
+  size_t mask = map->capacity - 1;
+  size_t i = hash_map_tile(tile->x, tile->y) & mask;
+  while (map->slots[i] != NULL) i = (i + 1) & mask;
+  map->slots[i] = tile;
+  map->count++;
+}
+
+// Returns '\0' for cells that were never set
+static inline char map_get(const map_grid_t *map, uint32_t x, uint32_t y) {
+  const map_tile_t *tile = map_find_tile(map, x / MAP_TILE_SIZE, y / MAP_TILE_SIZE);
+  if (tile == NULL) return '\0';
+  return tile->cells[y % MAP_TILE_SIZE][x % MAP_TILE_SIZE];
+}
+
+// Only valid on maps whose tiles were allocated by map_set() itself
+static void map_set(arena_t *arena, map_grid_t *map, uint32_t x, uint32_t y, char cell) {
+  map_tile_t *tile = (map_tile_t *)map_find_tile(map, x / MAP_TILE_SIZE, y / MAP_TILE_SIZE);
+  if (tile == NULL) {
+    tile = arena_alloc(arena, sizeof(*tile));
+    memset(tile, 0, sizeof(*tile));
+    tile->x = x / MAP_TILE_SIZE;
+    tile->y = y / MAP_TILE_SIZE;
+    map_insert_tile(arena, map, tile);
+  }
+  tile->cells[y % MAP_TILE_SIZE][x % MAP_TILE_SIZE] = cell;
+
+  if (x >= map->width) map->width = x + 1;
+  if (y >= map->height) map->height = y + 1;
+}
+
+// Rooms are plain indices. Everything that is only needed to print a room
+// lives in the per-room string arrays, while the exits of all rooms are packed
+// in compressed sparse row form: the exits of room i are
+// edges[edge_offsets[i]..edge_ends[i]], where edge_ends is edge_offsets + 1.
+// A watched adventure gets separate writable arrays so single rooms can be
+// patched, see watch_reload(). So does a lazy one, whose rooms append their
+// exits when they are parsed, see room_parse().
+typedef struct {
+  // Owns every table below, the strings either point into `source` or are
+  // owned by the arena as well
+  arena_t arena;
+  file_copy_t source;
+  map_grid_t map;
+  // Both point into the source file copy. A room that is only referenced by
+  // an exit has a NULL description. Read descriptions through room_description().
+  string_views_t names;
+  string_views_t descriptions;
+  uint32_t *edge_offsets;
+  uint32_t *edge_ends;
+  edge_t *edges;
+  size_t edge_count;
+  string_views_t directions;
+  room_lookup_t lookup;
+  uint32_t start_room;
+  // See adventure_content_hash(), 0 until it is first needed
+  uint64_t content_hash;
+  // Distinct description texts, rooms with the same text share its view
+  size_t unique_descriptions;
+  // Set by compress_descriptions(), the descriptions hold compressed text then
+  const char *dictionary;
+  uint32_t dictionary_size;
+  uint32_t compressed_id;
+  // Only used by adventures read with --lazy. Until a room is parsed its
+  // description is its whole source line and its exits start at ROOM_UNPARSED.
+  struct {
+    // Until adventure_parse_all() has parsed the rest and interned the descriptions
+    bool active;
+    size_t unparsed;
+    // Rooms that have slots in the exit arrays, and how many fit
+    size_t rooms;
+    size_t room_capacity;
+    size_t edge_capacity;
+  } lazy;
+} adventure_t;
+
+#define ROOM_UNPARSED UINT32_MAX
+
+#define START_ROOM_NAME "S"
+
+static void free_adventure(adventure_t *adventure) {
+  free_file_copy(&adventure->source);
+  arena_free(&adventure->arena);
+  *adventure = (adventure_t){0};
+}
+
+static inline size_t room_count(const adventure_t *adventure) {
+  return adventure->names.count;
+}
+
+static void room_parse(adventure_t *adventure, uint32_t room);
+static void adventure_parse_all(adventure_t *adventure);
+static void adventure_cache_account(const adventure_t *cached);
+
+// Returns the room behind the exit of `room` towards `direction`, or NO_ROOM
+static inline uint32_t room_exit(const adventure_t *adventure, uint32_t room, uint32_t direction) {
+  // Parsing a lazy room only fills in what it held all along, hence the cast
+  if (adventure->edge_offsets[room] == ROOM_UNPARSED) room_parse((adventure_t *)adventure, room);
+  for (uint32_t i = adventure->edge_offsets[room]; i < adventure->edge_ends[room]; ++i)
+    if (adventure->edges[i].direction == direction) return adventure->edges[i].target;
+  return NO_ROOM;
+}
+
+// There are only ever a handful of directions, a linear scan beats hashing
+static uint32_t find_direction(const adventure_t *adventure, String_View name) {
+  for (size_t i = 0; i < adventure->directions.count; ++i)
+    if (sv_eq(adventure->directions.items[i], name)) return (uint32_t)i;
+  return NO_DIRECTION;
+}
+
+static uint32_t intern_direction(adventure_t *adventure, String_View name) {
+  uint32_t index = find_direction(adventure, name);
+  if (index != NO_DIRECTION) return index;
+  arena_da_append(&adventure->arena, &adventure->directions, name);
+  return (uint32_t)adventure->directions.count - 1;
+}
+
+// FNV-1a, it is also baked into compiled adventures through the room lookup
+// so it must never change
+static inline uint32_t hash_string(String_View name) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < name.count; ++i) {
+    hash ^= (unsigned char)name.data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Open addressing map from a string's address to a value. Interned
+// descriptions share their address, so repeats are found without looking at
+// the text.
+typedef struct {
+  const char **keys;
+  uint32_t *values;
+  size_t capacity;
+} pointer_map_t;
+
+static void pointer_map_init(pointer_map_t *map, size_t count) {
+  map->capacity = 16;
+  while (map->capacity < count * 2) map->capacity *= 2;
+  map->keys = calloc(map->capacity, sizeof(*map->keys));
+  map->values = malloc(map->capacity * sizeof(*map->values));
+  assert(map->keys != NULL && map->values != NULL && "Buy more RAM lol");
+}
+
+static void pointer_map_free(pointer_map_t *map) {
+  free(map->keys);
+  free(map->values);
+  *map = (pointer_map_t){0};
+}
+
+// Returns the value slot for `key`, `found` tells whether it was there
+// before. At most half of the `count` given to pointer_map_init() may be used.
+static uint32_t *pointer_map_slot(pointer_map_t *map, const char *key, bool *found) {
+  size_t mask = map->capacity - 1;
+  size_t i = (size_t)(((uintptr_t)key * 0x9E3779B97F4A7C15ull) >> 20) & mask;
+  while (map->keys[i] != NULL && map->keys[i] != key) i = (i + 1) & mask;
+  *found = map->keys[i] != NULL;
+  map->keys[i] = key;
+  return &map->values[i];
+}
+
+// Compressed descriptions, enabled with --compress. Every adventure trains its
+// own dictionary from a sample of its descriptions, the way zstd's COVER
+// trainer does: the sample's 8 byte substrings are counted, then each stretch
+// of the sample gives the dictionary its segment with the most frequent
+// substrings. Descriptions are stored as LZ4 style sequences against that
+// dictionary: a token with 4 bit literal and match lengths, the literals, and
+// a varint distance back into the dictionary followed by the text decoded so
+// far. Descriptions are only decoded when shown, through a small direct
+// mapped cache, and the source file is let go after loading so only the
+// arena stays resident.
+#define DICTIONARY_CAPACITY (32*1024)
+#define DICTIONARY_SAMPLE_CAPACITY (1024*1024)
+#define DICTIONARY_SEGMENT 48
+#define DICTIONARY_DMER 8
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 16
+#define LZ_LOCAL_HASH_BITS 12
+#define LZ_MAX_CHAIN 16
+#define LZ_CHUNK_SIZE (64*1024)
+#define DESCRIPTION_CACHE_SIZE 64
+
+static bool compress_on_load = false;
+
+static inline uint32_t lz_hash4(const char *p, int bits) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return (value * 2654435761u) >> (32 - bits);
+}
+
+static inline uint32_t dmer_hash(const char *p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return (uint32_t)((value * 0x9E3779B97F4A7C15ull) >> (64 - LZ_HASH_BITS));
+}
+
+// Fills `dictionary` (DICTIONARY_CAPACITY bytes) and returns its size
+static size_t train_dictionary(const adventure_t *adventure, char *dictionary) {
+  size_t total = 0;
+  for (size_t i = 0; i < room_count(adventure); ++i) total += adventure->descriptions.items[i].count;
+
+  // Every nth description, so the sample covers the whole adventure
+  size_t stride = total / DICTIONARY_SAMPLE_CAPACITY + 1;
+  char *sample = malloc(total < DICTIONARY_SAMPLE_CAPACITY ? total + 1 : DICTIONARY_SAMPLE_CAPACITY);
+  assert(sample != NULL && "Buy more RAM lol");
+  size_t sample_size = 0;
+  for (size_t i = 0; i < room_count(adventure); i += stride) {
+    String_View description = adventure->descriptions.items[i];
+    if (sample_size + description.count > DICTIONARY_SAMPLE_CAPACITY) break;
+    memcpy(sample + sample_size, description.data, description.count);
+    sample_size += description.count;
+  }
+
+  size_t size = 0;
+  if (sample_size < DICTIONARY_SEGMENT) {
+    memcpy(dictionary, sample, sample_size);
+    free(sample);
+    return sample_size;
+  }
+
+  size_t dmer_count = sample_size - DICTIONARY_DMER + 1;
+  uint32_t *counts = calloc((size_t)1 << LZ_HASH_BITS, sizeof(uint32_t));
+  uint16_t *dmers = malloc(dmer_count * sizeof(uint16_t));
+  assert(counts != NULL && dmers != NULL && "Buy more RAM lol");
+  for (size_t i = 0; i < dmer_count; ++i) {
+    dmers[i] = (uint16_t)dmer_hash(sample + i);
+    counts[dmers[i]]++;
+  }
+
+  // A segment's score is the sum of its substrings' counts, chosen
+  // substrings are zeroed so later segments bring something new
+  const size_t window = DICTIONARY_SEGMENT - DICTIONARY_DMER + 1;
+  size_t epoch = sample_size / (DICTIONARY_CAPACITY / DICTIONARY_SEGMENT);
+  if (epoch < DICTIONARY_SEGMENT) epoch = DICTIONARY_SEGMENT;
+  for (size_t start = 0; start + DICTIONARY_SEGMENT <= sample_size && size + DICTIONARY_SEGMENT <= DICTIONARY_CAPACITY; start += epoch) {
+    size_t last = start + epoch < sample_size ? start + epoch : sample_size;
+    last -= DICTIONARY_SEGMENT;
+    if (last < start) last = start;
+
+    uint64_t score = 0;
+    for (size_t i = start; i < start + window; ++i) score += counts[dmers[i]];
+    uint64_t best_score = score;
+    size_t best = start;
+    for (size_t p = start + 1; p <= last; ++p) {
+      score += counts[dmers[p + window - 1]];
+      score -= counts[dmers[p - 1]];
+      if (score > best_score) {
+        best_score = score;
+        best = p;
+      }
+    }
+    if (best_score == 0) continue;
+
+    memcpy(dictionary + size, sample + best, DICTIONARY_SEGMENT);
+    size += DICTIONARY_SEGMENT;
+    for (size_t i = best; i < best + window; ++i) counts[dmers[i]] = 0;
+  }
+
+  free(counts);
+  free(dmers);
+  free(sample);
+  return size;
+}
+
+typedef struct {
+  const char *dictionary;
+  size_t dictionary_size;
+  // Hash chains over the dictionary, -1 ends a chain
+  int32_t head[1 << LZ_HASH_BITS];
+  int32_t *prev;
+  // Positions in the description being compressed, valid while `stamp` matches
+  struct {
+    uint32_t position;
+    uint32_t stamp;
+  } local[1 << LZ_LOCAL_HASH_BITS];
+  uint32_t stamp;
+} lz_compressor_t;
+
+static inline size_t lz_match_length(const char *a, const char *b, size_t limit) {
+  size_t length = 0;
+  while (length < limit && a[length] == b[length]) length++;
+  return length;
+}
+
+static inline void lz_put_length(String_Builder *out, size_t length) {
+  for (; length >= 255; length -= 255) da_append(out, (char)255);
+  da_append(out, (char)length);
+}
+
+static inline void lz_put_sequence(String_Builder *out, const char *literals, size_t literal_count, size_t distance, size_t match) {
+  size_t extra = match > 0 ? match - LZ_MIN_MATCH : 0;
+  da_append(out, (char)(((literal_count < 15 ? literal_count : 15) << 4) | (extra < 15 ? extra : 15)));
+  if (literal_count >= 15) lz_put_length(out, literal_count - 15);
+  sb_append_buf(out, literals, literal_count);
+  if (match == 0) return;
+  for (; distance >= 0x80; distance >>= 7) da_append(out, (char)(distance | 0x80));
+  da_append(out, (char)distance);
+  if (extra >= 15) lz_put_length(out, extra - 15);
+}
+
+static void lz_compress(lz_compressor_t *lz, String_View text, String_Builder *out) {
+  const char *src = text.data;
+  size_t n = text.count, i = 0, literal_start = 0;
+  lz->stamp++;
+  while (i + LZ_MIN_MATCH <= n) {
+    size_t best = 0, distance = 0;
+    for (int32_t candidate = lz->head[lz_hash4(src + i, LZ_HASH_BITS)], depth = 0;
+         candidate >= 0 && depth < LZ_MAX_CHAIN; candidate = lz->prev[candidate], depth++) {
+      size_t limit = lz->dictionary_size - (size_t)candidate;
+      if (limit > n - i) limit = n - i;
+      size_t length = lz_match_length(lz->dictionary + candidate, src + i, limit);
+      if (length > best) {
+        best = length;
+        distance = lz->dictionary_size - (size_t)candidate + i;
+      }
+    }
+    uint32_t slot = lz_hash4(src + i, LZ_LOCAL_HASH_BITS);
+    if (lz->local[slot].stamp == lz->stamp) {
+      size_t position = lz->local[slot].position;
+      size_t length = lz_match_length(src + position, src + i, n - i);
+      if (length > best) {
+        best = length;
+        distance = i - position;
+      }
+    }
+    lz->local[slot].position = (uint32_t)i;
+    lz->local[slot].stamp = lz->stamp;
+
+    if (best < LZ_MIN_MATCH) {
+      i++;
+      continue;
+    }
+    lz_put_sequence(out, src + literal_start, i - literal_start, distance, best);
+    i += best;
+    literal_start = i;
+  }
+  if (literal_start < n) lz_put_sequence(out, src + literal_start, n - literal_start, 0, 0);
+}
+
+static void lz_reserve(String_Builder *out, size_t capacity) {
+  if (capacity <= out->capacity) return;
+  size_t grown = out->capacity > 0 ? out->capacity : NOB_DA_INIT_CAP;
+  while (grown < capacity) grown *= 2;
+  out->items = realloc(out->items, grown);
+  assert(out->items != NULL && "Buy more RAM lol");
+  out->capacity = grown;
+}
+
+static inline size_t lz_get_length(const unsigned char **p, const unsigned char *end, size_t length) {
+  if (length < 15) return length;
+  while (*p < end) {
+    unsigned char byte = *(*p)++;
+    length += byte;
+    if (byte != 255) break;
+  }
+  return length;
+}
+
+// Appends the text of a compressed description to `out`, which must not
+// hold anything else since matches reach back into it
+static void lz_decompress(const adventure_t *adventure, String_View compressed, String_Builder *out) {
+  const unsigned char *p = (const unsigned char *)compressed.data, *end = p + compressed.count;
+  const size_t dictionary_size = adventure->dictionary_size;
+  while (p < end) {
+    unsigned char token = *p++;
+    size_t literal_count = lz_get_length(&p, end, token >> 4);
+    if (literal_count > (size_t)(end - p)) literal_count = end - p;
+    sb_append_buf(out, p, literal_count);
+    p += literal_count;
+    if (p >= end) break;
+
+    size_t distance = 0;
+    for (int shift = 0; p < end; shift += 7) {
+      unsigned char byte = *p++;
+      distance |= (size_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) break;
+    }
+    size_t match = lz_get_length(&p, end, token & 15) + LZ_MIN_MATCH;
+    if (distance == 0 || distance > dictionary_size + out->count) return;
+
+    // The match may overlap its own output, so it goes byte by byte
+    lz_reserve(out, out->count + match);
+    size_t from = dictionary_size + out->count - distance;
+    for (size_t i = 0; i < match; ++i, ++from)
+      out->items[out->count++] = from < dictionary_size
+        ? adventure->dictionary[from]
+        : out->items[from - dictionary_size];
+  }
+}
+
+static struct {
+  // compressed_id of the adventure, 0 for empty slots
+  uint32_t id;
+  uint32_t room;
+  String_Builder text;
+} description_cache[DESCRIPTION_CACHE_SIZE] = {};
+
+// The text of a room's description. For compressed adventures the view stays
+// valid until another description is decoded into the same cache slot.
+static String_View room_description(const adventure_t *adventure, uint32_t room) {
+  if (adventure->edge_offsets[room] == ROOM_UNPARSED) room_parse((adventure_t *)adventure, room);
+  String_View stored = adventure->descriptions.items[room];
+  if (adventure->dictionary == NULL || stored.data == NULL) return stored;
+
+  size_t slot = room % DESCRIPTION_CACHE_SIZE;
+  if (description_cache[slot].id != adventure->compressed_id || description_cache[slot].room != room) {
+    description_cache[slot].text.count = 0;
+    lz_decompress(adventure, stored, &description_cache[slot].text);
+    description_cache[slot].id = adventure->compressed_id;
+    description_cache[slot].room = room;
+  }
+  return sv_from_parts(description_cache[slot].text.items, description_cache[slot].text.count);
+}
+
+// Replaces every description with its compressed form in the arena, returns
+// the compressed size with the dictionary included
+static size_t compress_descriptions(adventure_t *adventure) {
+  static uint32_t next_id = 0;
+  if (adventure->dictionary != NULL) return 0;
+  adventure_parse_all(adventure);
+
+  char *dictionary = arena_alloc(&adventure->arena, DICTIONARY_CAPACITY);
+  lz_compressor_t *lz = malloc(sizeof(*lz));
+  assert(lz != NULL && "Buy more RAM lol");
+  lz->dictionary = dictionary;
+  lz->dictionary_size = train_dictionary(adventure, dictionary);
+  lz->prev = malloc((lz->dictionary_size + 1) * sizeof(int32_t));
+  assert(lz->prev != NULL && "Buy more RAM lol");
+  memset(lz->head, 0xff, sizeof(lz->head));
+  memset(lz->local, 0, sizeof(lz->local));
+  lz->stamp = 0;
+  for (size_t i = 0; i + LZ_MIN_MATCH <= lz->dictionary_size; ++i) {
+    uint32_t hash = lz_hash4(dictionary + i, LZ_HASH_BITS);
+    lz->prev[i] = lz->head[hash];
+    lz->head[hash] = (int32_t)i;
+  }
+
+  // Compressed descriptions are packed into chunks without alignment
+  // padding, rooms sharing an interned description share the compressed one
+  String_Builder out = {0};
+  char *chunk = NULL;
+  size_t chunk_left = 0, compressed = lz->dictionary_size;
+  pointer_map_t shared;
+  pointer_map_init(&shared, room_count(adventure));
+  for (size_t i = 0; i < room_count(adventure); ++i) {
+    String_View description = adventure->descriptions.items[i];
+    if (description.data == NULL) continue;
+    bool found;
+    uint32_t *first = pointer_map_slot(&shared, description.data, &found);
+    if (found) {
+      adventure->descriptions.items[i] = adventure->descriptions.items[*first];
+      continue;
+    }
+    *first = (uint32_t)i;
+    out.count = 0;
+    lz_compress(lz, description, &out);
+    if (chunk == NULL || out.count > chunk_left) {
+      chunk_left = out.count > LZ_CHUNK_SIZE ? out.count : LZ_CHUNK_SIZE;
+      chunk = arena_alloc(&adventure->arena, chunk_left);
+    }
+    memcpy(chunk, out.items, out.count);
+    adventure->descriptions.items[i] = sv_from_parts(chunk, out.count);
+    chunk += out.count;
+    chunk_left -= out.count;
+    compressed += out.count;
+  }
+
+  adventure->dictionary = dictionary;
+  adventure->dictionary_size = (uint32_t)lz->dictionary_size;
+  pointer_map_free(&shared);
+  sb_free(out);
+  free(lz->prev);
+  free(lz);
+  adventure->compressed_id = ++next_id;
+  return compressed;
+}
+
+static inline bool in_source(const adventure_t *adventure, const void *pointer) {
+  const char *begin = adventure->source.data;
+  return (const char *)pointer >= begin && (const char *)pointer < begin + adventure->source.size;
+}
+
+static void detach_views(adventure_t *adventure, string_views_t *views) {
+  size_t total = 0;
+  for (size_t i = 0; i < views->count; ++i)
+    if (in_source(adventure, views->items[i].data)) total += views->items[i].count;
+  char *copy = arena_alloc(&adventure->arena, total);
+  for (size_t i = 0; i < views->count; ++i) {
+    if (!in_source(adventure, views->items[i].data)) continue;
+    memcpy(copy, views->items[i].data, views->items[i].count);
+    views->items[i].data = copy;
+    copy += views->items[i].count;
+  }
+}
+
+static void *detach_array(adventure_t *adventure, void *items, size_t size) {
+  if (!in_source(adventure, items)) return items;
+  void *copy = arena_alloc(&adventure->arena, size);
+  memcpy(copy, items, size);
+  return copy;
+}
+
+// Copies everything that still points into the source file into the arena
+// and frees it
+static void detach_source(adventure_t *adventure) {
+  if (adventure->source.data == NULL) return;
+  detach_views(adventure, &adventure->names);
+  detach_views(adventure, &adventure->descriptions);
+  detach_views(adventure, &adventure->directions);
+
+  // Compiled adventures use these in place
+  bool packed_ends = adventure->edge_ends == adventure->edge_offsets + 1;
+  adventure->edge_offsets = detach_array(adventure, adventure->edge_offsets, (room_count(adventure) + 1) * sizeof(uint32_t));
+  if (packed_ends) adventure->edge_ends = adventure->edge_offsets + 1;
+  adventure->edges = detach_array(adventure, adventure->edges, adventure->edge_count * sizeof(edge_t));
+  adventure->lookup.slots = detach_array(adventure, adventure->lookup.slots, adventure->lookup.capacity * sizeof(uint32_t));
+  for (size_t i = 0; i < adventure->map.capacity; ++i)
+    if (adventure->map.slots[i] != NULL)
+      adventure->map.slots[i] = detach_array(adventure, (void *)adventure->map.slots[i], sizeof(map_tile_t));
+
+  free_file_copy(&adventure->source);
+}
+
+// 64-bit word at a time mixing for content hashes, they only tell versions
+// apart and are never part of a file format's lookups
+static inline uint64_t hash_mix(uint64_t hash, uint64_t value) {
+  hash = (hash ^ value) * 0x9E3779B97F4A7C15ull;
+  return hash ^ (hash >> 29);
+}
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t count) {
+  const unsigned char *bytes = data;
+  for (; count >= 8; bytes += 8, count -= 8) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    hash = hash_mix(hash, word);
+  }
+  // The length goes into the low byte so "a" and "a\0" differ
+  uint64_t tail = count;
+  for (size_t i = 0; i < count; ++i) tail |= (uint64_t)bytes[i] << (8 * (i + 1));
+  return hash_mix(hash, tail);
+}
+
+static inline uint64_t hash_sv(uint64_t hash, String_View sv) {
+  // Undefined descriptions hash differently from empty ones
+  if (sv.data == NULL) return hash_mix(hash, UINT64_MAX);
+  return hash_bytes(hash, sv.data, sv.count);
+}
+
+// Rooms and directions are numbered in the order a load meets them, which
+// differs between lazy and full loads, so whatever outlives the process names
+// a room by this hash instead of its number
+static inline uint64_t room_name_hash(const adventure_t *adventure, uint32_t room) {
+  return hash_sv(0x7461652d726f6f6dull, adventure->names.items[room]);
+}
+
+// The defined room behind a room_name_hash(), or NO_ROOM
+static uint32_t find_room_by_name_hash(const adventure_t *adventure, uint64_t hash) {
+  for (size_t i = 0; i < room_count(adventure); ++i)
+    if (adventure->descriptions.items[i].data != NULL && room_name_hash(adventure, (uint32_t)i) == hash)
+      return (uint32_t)i;
+  return NO_ROOM;
+}
+
+// Hashes what a session can observe: rooms, descriptions, exits and the map.
+// Rooms and directions go in by name, so the hash does not depend on how the
+// adventure was loaded, a .ta file and the .tac compiled from it hash the same.
+// Computed on first use and kept until the adventure changes.
+static uint64_t adventure_content_hash(adventure_t *adventure) {
+  if (adventure->content_hash != 0) return adventure->content_hash;
+  adventure_parse_all(adventure);
+
+  // Every name is hashed once up front, exits would hash their targets again and again
+  size_t count = room_count(adventure);
+  uint64_t *names = malloc((count ? count : 1) * sizeof(*names));
+  uint64_t *directions = malloc((adventure->directions.count ? adventure->directions.count : 1) * sizeof(*directions));
+  assert(names != NULL && directions != NULL && "Buy more RAM lol");
+  for (size_t i = 0; i < count; ++i) names[i] = room_name_hash(adventure, (uint32_t)i);
+  for (size_t i = 0; i < adventure->directions.count; ++i) directions[i] = hash_sv(0, adventure->directions.items[i]);
+
+  uint64_t hash = hash_mix(0x7461652d68617368ull, room_name_hash(adventure, adventure->start_room));
+  // Like the tiles below the rooms are summed, their order is up to the load.
+  // Rooms that are only named by exits show up through those.
+  uint64_t rooms = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (adventure->descriptions.items[i].data == NULL) continue;
+    uint64_t room = hash_sv(names[i], room_description(adventure, (uint32_t)i));
+    uint32_t begin = adventure->edge_offsets[i], end = adventure->edge_ends[i];
+    room = hash_mix(room, end - begin);
+    for (uint32_t e = begin; e < end; ++e)
+      room = hash_mix(hash_mix(room, directions[adventure->edges[e].direction]), names[adventure->edges[e].target]);
+    rooms += room;
+  }
+  hash = hash_mix(hash, rooms);
+  free(names);
+  free(directions);
+
+  // Tiles sit in hash order, so their hashes are summed instead of chained
+  uint64_t tiles = 0;
+  for (size_t i = 0; i < adventure->map.capacity; ++i)
+    if (adventure->map.slots[i] != NULL)
+      tiles += hash_bytes(0, adventure->map.slots[i], sizeof(map_tile_t));
+  hash = hash_mix(hash, ((uint64_t)adventure->map.width << 32) | adventure->map.height);
+  hash = hash_mix(hash, tiles);
+
+  adventure->content_hash = hash != 0 ? hash : 1;
+  return adventure->content_hash;
+}
+
+static uint32_t find_room(const adventure_t *adventure, String_View name) {
+  if (adventure->lookup.capacity == 0) return NO_ROOM;
+  size_t mask = adventure->lookup.capacity - 1;
+  for (size_t i = hash_string(name) & mask;; i = (i + 1) & mask) {
+    uint32_t index = adventure->lookup.slots[i];
+    if (index == NO_ROOM || sv_eq(adventure->names.items[index], name))
+      return index;
+  }
+}
+
+static void room_lookup_insert(room_lookup_t *lookup, String_View name, uint32_t index) {
+  size_t mask = lookup->capacity - 1;
+  size_t i = hash_string(name) & mask;
+  while (lookup->slots[i] != NO_ROOM) i = (i + 1) & mask;
+  lookup->slots[i] = index;
+}
+
+// Returns the index of the room called `name`, adding an undefined room when
+// it has not been seen before
+static uint32_t intern_room(adventure_t *adventure, String_View name) {
+  uint32_t index = find_room(adventure, name);
+  if (index != NO_ROOM) return index;
+
+  // Keep the load factor at or below 1/2
+  if ((room_count(adventure) + 1) * 2 > adventure->lookup.capacity) {
+    room_lookup_t grown = {0};
+    grown.capacity = adventure->lookup.capacity ? adventure->lookup.capacity * 2 : 64;
+    grown.slots = arena_alloc(&adventure->arena, grown.capacity * sizeof(*grown.slots));
+    memset(grown.slots, 0xff, grown.capacity * sizeof(*grown.slots));
+    for (size_t i = 0; i < room_count(adventure); ++i)
+      room_lookup_insert(&grown, adventure->names.items[i], (uint32_t)i);
+    adventure->lookup = grown;
+  }
+
+  index = (uint32_t)room_count(adventure);
+  arena_da_append(&adventure->arena, &adventure->names, name);
+  arena_da_append(&adventure->arena, &adventure->descriptions, ((String_View){0}));
+  room_lookup_insert(&adventure->lookup, name, index);
+  return index;
+}
+
+// Byte searches used by the parser. They return `count` when nothing was
+// found. The vector versions are picked once at runtime from what the CPU
+// supports, everything else falls back to plain loops.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+typedef size_t (find_byte_t)(const char *data, size_t count, char byte);
+typedef size_t (find_either_byte_t)(const char *data, size_t count, char a, char b);
+
+static size_t find_byte_scalar(const char *data, size_t count, char byte) {
+  size_t i = 0;
+  while (i < count && data[i] != byte) i++;
+  return i;
+}
+
+static size_t find_either_byte_scalar(const char *data, size_t count, char a, char b) {
+  size_t i = 0;
+  while (i < count && data[i] != a && data[i] != b) i++;
+  return i;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static size_t find_byte_sse2(const char *data, size_t count, char byte) {
+  __m128i needle = _mm_set1_epi8(byte);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+  return i + find_byte_scalar(data + i, count - i, byte);
+}
+
+__attribute__((target("sse2")))
+static size_t find_either_byte_sse2(const char *data, size_t count, char a, char b) {
+  __m128i needle_a = _mm_set1_epi8(a);
+  __m128i needle_b = _mm_set1_epi8(b);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, needle_a), _mm_cmpeq_epi8(chunk, needle_b));
+    unsigned mask = (unsigned)_mm_movemask_epi8(hits);
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+  return i + find_either_byte_scalar(data + i, count - i, a, b);
+}
+
+__attribute__((target("avx2")))
+static size_t find_byte_avx2(const char *data, size_t count, char byte) {
+  __m256i needle = _mm256_set1_epi8(byte);
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)(data + i));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+  return i + find_byte_scalar(data + i, count - i, byte);
+}
+
+__attribute__((target("avx2")))
+static size_t find_either_byte_avx2(const char *data, size_t count, char a, char b) {
+  __m256i needle_a = _mm256_set1_epi8(a);
+  __m256i needle_b = _mm256_set1_epi8(b);
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, needle_a), _mm256_cmpeq_epi8(chunk, needle_b));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(hits);
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+  return i + find_either_byte_scalar(data + i, count - i, a, b);
+}
+#endif // SCAN_X86
+
+static find_byte_t *find_byte_impl = NULL;
+static find_either_byte_t *find_either_byte_impl = NULL;
+
+static void select_scan_impl(void) {
+  find_byte_impl = find_byte_scalar;
+  find_either_byte_impl = find_either_byte_scalar;
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    find_byte_impl = find_byte_avx2;
+    find_either_byte_impl = find_either_byte_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    find_byte_impl = find_byte_sse2;
+    find_either_byte_impl = find_either_byte_sse2;
+  }
+#endif // SCAN_X86
+}
+
+static inline size_t find_byte(const char *data, size_t count, char byte) {
+  if (find_byte_impl == NULL) select_scan_impl();
+  return find_byte_impl(data, count, byte);
+}
+
+static inline size_t find_either_byte(const char *data, size_t count, char a, char b) {
+  if (find_either_byte_impl == NULL) select_scan_impl();
+  return find_either_byte_impl(data, count, a, b);
+}
+
+// Same as sv_chop_by_delim() but scans with find_byte()
+static inline String_View sv_chop_by_byte(String_View *sv, char delim) {
+  size_t i = find_byte(sv->data, sv->count, delim);
+  String_View result = sv_from_parts(sv->data, i);
+  size_t skip = i < sv->count ? i + 1 : i;
+  sv->count -= skip;
+  sv->data += skip;
+  return result;
+}
+
+#ifdef _WIN32
+String_View sv_chop_by_newline(String_View *sv) {
+  String_View part = sv_chop_by_byte((sv), '\n');
+  return sv_chop_by_byte(&part, '\r');
+}
+#else
+String_View sv_chop_by_newline(String_View *sv) {
+  return sv_chop_by_byte(sv, '\n');
+}
+#endif //_WIN32
+typedef int (chop_predicate_t)(int);
+String_View sv_chop_by_predicate(String_View *sv, chop_predicate_t predicate) {
+    size_t i = 0;
+    while (i < sv->count && !predicate(sv->data[i])) {
+        i += 1;
+    }
+
+    Nob_String_View result = nob_sv_from_parts(sv->data, i);
+
+    if (i < sv->count) {
+        sv->count -= i + 1;
+        sv->data  += i + 1;
+    } else {
+        sv->count -= i;
+        sv->data  += i;
+    }
+
+    return result;
+}
+
+#define error_read(filename) \
+  do { \
+    log_message(temp_sprintf(COLOR_RED"Error %d: could not read adventure file: %s", __LINE__, (filename))); \
+    return_defer(false); \
+  } while (0);
+
+#define error_invalid(filename) \
+  do { \
+  log_message(temp_sprintf(COLOR_RED"Error %d: invalid or corrupt adventure file: %s", __LINE__, (filename))); \
+  return_defer(false); \
+  } while (0);
+
+// An exit as it appears in the source, before it is sorted into the CSR arrays
+typedef struct {
+  uint32_t source;
+  // Which definition of `source` declared it, only the last one counts
+  uint32_t definition;
+  edge_t edge;
+} parsed_edge_t;
+
+// Counting sort of the parsed exits by source room, keeping file order within a room
+static void build_room_edges(adventure_t *dest, const parsed_edge_t *parsed, size_t parsed_count, const uint32_t *definitions) {
+  size_t count = room_count(dest);
+  dest->edge_offsets = arena_alloc(&dest->arena, (count + 1) * sizeof(*dest->edge_offsets));
+  memset(dest->edge_offsets, 0, (count + 1) * sizeof(*dest->edge_offsets));
+
+  size_t edge_count = 0;
+  for (size_t i = 0; i < parsed_count; ++i) {
+    if (parsed[i].definition != definitions[parsed[i].source]) continue;
+    dest->edge_offsets[parsed[i].source + 1]++;
+    edge_count++;
+  }
+  for (size_t i = 0; i < count; ++i)
+    dest->edge_offsets[i + 1] += dest->edge_offsets[i];
+  dest->edge_ends = dest->edge_offsets + 1;
+
+  dest->edges = arena_alloc(&dest->arena, edge_count * sizeof(*dest->edges));
+  uint32_t *cursor = malloc((count ? count : 1) * sizeof(*cursor));
+  assert(cursor != NULL && "Buy more RAM lol");
+  memcpy(cursor, dest->edge_offsets, count * sizeof(*cursor));
+  for (size_t i = 0; i < parsed_count; ++i) {
+    if (parsed[i].definition != definitions[parsed[i].source]) continue;
+    dest->edges[cursor[parsed[i].source]++] = parsed[i].edge;
+  }
+  dest->edge_count = edge_count;
+  free(cursor);
+}
+
+typedef struct {
+  parsed_edge_t *items;
+  size_t count;
+  size_t capacity;
+} parsed_edges_t;
+
+// Parses one `name="description"(direction=target,...);` line. The room and
+// its exit targets are interned, its exits are appended to `edges`. Without
+// `dest` the line is only checked, which is what the lazy index pass does.
+static bool parse_room_line(adventure_t *dest, String_View line, uint32_t definition,
+                            uint32_t *room, String_View *description, parsed_edges_t *edges) {
+  if (!sv_end_with(line, ";")) return false;
+  String_View name = sv_chop_by_byte(&line, '=');
+  if (name.count == 0 || line.count == 0) return false;
+  if (line.data[0] != '"') return false;
+  uint32_t index = dest != NULL ? intern_room(dest, name) : NO_ROOM;
+  sv_chop_by_byte(&line, '"');
+  String_View value = sv_chop_by_byte(&line, '"');
+  // Every chop can use up the line, the last byte of a file is not followed by anything
+  if (line.count == 0) return false;
+  if (line.data[0] == '(') {
+    line.count--;
+    line.data++;
+    if (line.count == 0 || line.data[0] == ';') return false;
+    while (line.count > 1 && line.data[0] != ';') {
+      String_View direction = sv_chop_by_byte(&line, '=');
+      if (direction.count == 0) return false;
+      size_t n = find_either_byte(line.data, line.count, ',', ')');
+      if (n == 0 || n == line.count) return false;
+      if (dest != NULL) {
+        parsed_edge_t edge = {
+          .source = index,
+          .definition = definition,
+          .edge = {
+            .direction = intern_direction(dest, direction),
+            .target = intern_room(dest, sv_from_parts(line.data, n)),
+          },
+        };
+        da_append(edges, edge);
+      }
+      line.count -= n + 1;
+      line.data += n + 1;
+    }
+  }
+  if (line.count == 0 || line.data[0] != ';') return false;
+
+  *room = index;
+  *description = value;
+  return true;
+}
+
+// Identical descriptions are stored once: the parser looks every description
+// up by content and rooms with the same text share one String_View. Only the
+// parser needs the table, it holds the hash and a room that has the text.
+typedef struct {
+  uint32_t hash;
+  uint32_t room;
+} description_slot_t;
+
+typedef struct {
+  description_slot_t *slots;
+  size_t capacity;
+  size_t count;
+} description_table_t;
+
+static inline uint32_t hash_description(String_View description) {
+  uint64_t hash = hash_bytes(0, description.data, description.count);
+  return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static void description_table_insert(description_table_t *table, uint32_t hash, uint32_t room) {
+  size_t mask = table->capacity - 1;
+  size_t i = hash & mask;
+  while (table->slots[i].room != NO_ROOM) i = (i + 1) & mask;
+  table->slots[i] = (description_slot_t){ .hash = hash, .room = room };
+  table->count++;
+}
+
+// Returns the shared view for `description`, which becomes the shared one
+// when the text has not been seen before
+static String_View intern_description(description_table_t *table, const adventure_t *adventure,
+                                      uint32_t room, String_View description) {
+  uint32_t hash = hash_description(description);
+  if (table->capacity > 0) {
+    size_t mask = table->capacity - 1;
+    for (size_t i = hash & mask; table->slots[i].room != NO_ROOM; i = (i + 1) & mask) {
+      if (table->slots[i].hash != hash) continue;
+      // A redefined room may no longer have the text it was entered with
+      String_View known = adventure->descriptions.items[table->slots[i].room];
+      if (known.count == description.count && memcmp(known.data, description.data, known.count) == 0)
+        return known;
+    }
+  }
+
+  // Keep the load factor at or below 1/2
+  if ((table->count + 1) * 2 > table->capacity) {
+    description_table_t grown = { .capacity = table->capacity ? table->capacity * 2 : 1024 };
+    grown.slots = malloc(grown.capacity * sizeof(*grown.slots));
+    assert(grown.slots != NULL && "Buy more RAM lol");
+    memset(grown.slots, 0xff, grown.capacity * sizeof(*grown.slots));
+    for (size_t i = 0; i < table->capacity; ++i)
+      if (table->slots[i].room != NO_ROOM) description_table_insert(&grown, table->slots[i].hash, table->slots[i].room);
+    free(table->slots);
+    *table = grown;
+  }
+  description_table_insert(table, hash, room);
+  return description;
+}
+
+// Parses a room of a lazy adventure the first time it is needed. Its exits
+// are appended to the exit arrays, targets that show up for the first time
+// here were never defined, the index pass would have seen them otherwise.
+static void room_parse(adventure_t *adventure, uint32_t room) {
+  size_t used = adventure->arena.used;
+  String_View line = adventure->descriptions.items[room];
+  parsed_edges_t parsed = {0};
+  uint32_t index;
+  String_View description;
+  if (!parse_room_line(adventure, line, 0, &index, &description, &parsed)) {
+    log_message(temp_sprintf(COLOR_RED"Error: invalid definition of room \""SV_Fmt"\", it is left empty",
+                             SV_Arg(adventure->names.items[room])));
+    description = sv_from_parts(line.data, 0);
+    parsed.count = 0;
+  }
+
+  size_t count = room_count(adventure);
+  if (count > adventure->lazy.room_capacity) {
+    size_t capacity = adventure->lazy.room_capacity * 2;
+    if (capacity < count) capacity = count;
+    // One spare slot keeps room_count + 1 offsets readable like in packed arrays
+    adventure->edge_offsets = arena_realloc(&adventure->arena, adventure->edge_offsets,
+                                            (adventure->lazy.room_capacity + 1) * sizeof(uint32_t),
+                                            (capacity + 1) * sizeof(uint32_t));
+    adventure->edge_ends = arena_realloc(&adventure->arena, adventure->edge_ends,
+                                         adventure->lazy.room_capacity * sizeof(uint32_t),
+                                         capacity * sizeof(uint32_t));
+    adventure->lazy.room_capacity = capacity;
+  }
+  for (size_t i = adventure->lazy.rooms; i < count; ++i)
+    adventure->edge_offsets[i] = adventure->edge_ends[i] = 0;
+  adventure->edge_offsets[count] = 0;
+  adventure->lazy.rooms = count;
+
+  size_t edge_count = adventure->edge_count + parsed.count;
+  if (edge_count > adventure->lazy.edge_capacity) {
+    size_t capacity = adventure->lazy.edge_capacity ? adventure->lazy.edge_capacity * 2 : 1024;
+    while (capacity < edge_count) capacity *= 2;
+    adventure->edges = arena_realloc(&adventure->arena, adventure->edges,
+                                     adventure->lazy.edge_capacity * sizeof(edge_t), capacity * sizeof(edge_t));
+    adventure->lazy.edge_capacity = capacity;
+  }
+  adventure->edge_offsets[room] = (uint32_t)adventure->edge_count;
+  for (size_t i = 0; i < parsed.count; ++i)
+    adventure->edges[adventure->edge_count++] = parsed.items[i].edge;
+  adventure->edge_ends[room] = (uint32_t)adventure->edge_count;
+  adventure->descriptions.items[room] = description;
+  adventure->lazy.unparsed--;
+  da_free(parsed);
+  if (adventure->arena.used != used) adventure_cache_account(adventure);
+}
+
+// Parses the rooms a lazy adventure has not needed yet, for everything that
+// looks at the whole adventure. The descriptions are interned then, the way a
+// full load interns them while parsing.
+static void adventure_parse_all(adventure_t *adventure) {
+  if (!adventure->lazy.active) return;
+  for (size_t i = 0; adventure->lazy.unparsed > 0 && i < room_count(adventure); ++i)
+    if (adventure->edge_offsets[i] == ROOM_UNPARSED) room_parse(adventure, (uint32_t)i);
+
+  description_table_t interned = {0};
+  for (size_t i = 0; i < room_count(adventure); ++i) {
+    String_View description = adventure->descriptions.items[i];
+    if (description.data == NULL) continue;
+    adventure->descriptions.items[i] = intern_description(&interned, adventure, (uint32_t)i, description);
+  }
+  adventure->unique_descriptions = interned.count;
+  free(interned.slots);
+  adventure->lazy.active = false;
+}
+
+// Names and descriptions are kept as views into the source file, so `dest`
+// owns its copy of the file and it must be released with free_adventure().
+// With `lazy` only the room names are read, each room keeps its line until
+// room_parse() needs it, which makes the load as cheap as finding the names.
+static bool read_adventure_source(const char *filename, adventure_t *dest, bool lazy) {
+  bool result = true;
+  *dest = (adventure_t){0};
+  parsed_edges_t parsed = {};
+  // Last definition of every room, NO_ROOM when it was never defined
+  struct {
+    uint32_t *items;
+    size_t count;
+    size_t capacity;
+  } definitions = {};
+  uint32_t definition = 0;
+  description_table_t interned = {0};
+  bool redefined = false;
+
+  if (!read_file_copy(filename, &dest->source)) error_read(filename);
+
+  String_View view = {
+    .data = dest->source.data,
+    .count = dest->source.size
+  };
+  view = sv_trim(view);
+
+  String_View line = sv_chop_by_newline(&view);
+  if (!sv_eq(line, SV("map"))) error_invalid(filename);
+  line = sv_chop_by_newline(&view);
+
+  bool pam = false;
+  uint32_t row = 0;
+  while (line.count > 0) {
+    if (sv_eq(line, SV("pam"))) {
+      pam = true;
+      line = sv_chop_by_newline(&view);
+      break;
+    }
+    
+    for (size_t i = 0; i < line.count; ++i) {
+      if (line.data[i] != ' ' && !(line.data[i] == '\n' || line.data[i] == '\r'))
+        map_set(&dest->arena, &dest->map, (uint32_t)i, row, line.data[i]);
+    }
+    
+    line = sv_chop_by_newline(&view);
+    row++;
+  }
+  if (!pam) error_invalid(filename);
+
+  if (!sv_eq(line, SV("rooms"))) error_invalid(filename);
+  line = sv_chop_by_newline(&view);
+
+  bool smoor = false;
+  while (line.count > 0) {
+    if (line.data[0] == '#') goto skip;
+    if (sv_eq(line, SV("smoor"))) {
+      smoor = true;
+      line = sv_chop_by_newline(&view);
+      break;
+    }
+    if (lazy) {
+      // Only checked for now, a later definition of a room replaces the
+      // line like it would replace the room
+      uint32_t unused;
+      String_View description;
+      if (!parse_room_line(NULL, line, 0, &unused, &description, NULL)) error_invalid(filename);
+      size_t n = find_byte(line.data, line.count, '=');
+      uint32_t index = intern_room(dest, sv_from_parts(line.data, n));
+      dest->descriptions.items[index] = line;
+      goto skip;
+    }
+    uint32_t index;
+    String_View value;
+    definition++;
+    if (!parse_room_line(dest, line, definition, &index, &value, &parsed)) error_invalid(filename);
+    dest->descriptions.items[index] = intern_description(&interned, dest, index, value);
+    while (definitions.count < room_count(dest)) da_append(&definitions, NO_ROOM);
+    redefined |= definitions.items[index] != NO_ROOM;
+    definitions.items[index] = definition;
+skip:
+    line = sv_chop_by_newline(&view);
+  }
+  if (!smoor) error_invalid(filename);
+
+  if (lazy) {
+    size_t count = room_count(dest);
+    dest->edge_offsets = arena_alloc(&dest->arena, (count + 1) * sizeof(uint32_t));
+    dest->edge_ends = arena_alloc(&dest->arena, count * sizeof(uint32_t));
+    for (size_t i = 0; i < count; ++i) {
+      dest->edge_offsets[i] = ROOM_UNPARSED;
+      dest->edge_ends[i] = 0;
+    }
+    dest->edge_offsets[count] = 0;
+    dest->lazy.unparsed = dest->lazy.rooms = dest->lazy.room_capacity = count;
+    dest->lazy.active = true;
+  }
+
+  dest->start_room = find_room(dest, SV(START_ROOM_NAME));
+  // A start room that is never defined is only known to the exits
+  if (dest->start_room == NO_ROOM && lazy) {
+    adventure_parse_all(dest);
+    dest->start_room = find_room(dest, SV(START_ROOM_NAME));
+  }
+  if (dest->start_room == NO_ROOM) error_invalid(filename);
+
+  if (!lazy) {
+    while (definitions.count < room_count(dest)) da_append(&definitions, NO_ROOM);
+    build_room_edges(dest, parsed.items, parsed.count, definitions.items);
+    dest->unique_descriptions = interned.count;
+    // The table still has the texts of rooms that were defined again later
+    if (redefined) {
+      pointer_map_t live;
+      pointer_map_init(&live, room_count(dest));
+      dest->unique_descriptions = 0;
+      for (size_t i = 0; i < room_count(dest); ++i) {
+        bool found;
+        if (dest->descriptions.items[i].data == NULL) continue;
+        pointer_map_slot(&live, dest->descriptions.items[i].data, &found);
+        if (!found) dest->unique_descriptions++;
+      }
+      pointer_map_free(&live);
+    }
+  }
+
+defer:
+  da_free(parsed);
+  da_free(definitions);
+  free(interned.slots);
+  if (!result) free_adventure(dest);
+  return result;
+}
+
+static bool read_adventure_file(const char *filename, adventure_t *dest) {
+  return read_adventure_source(filename, dest, false);
+}
+
+// Compiled adventure (.tac) layout, all integers are in the byte order of the
+// machine that compiled it, which `byte_order` records:
+//
+//   tac_header_t
+//   tac_room_t[room_count]                    at rooms_offset
+//   uint32_t[room_count + 1]                  at edge_offsets_offset
+//   edge_t[edge_count]                        at edges_offset
+//   tac_string_t[direction_count]             at directions_offset
+//   uint32_t[lookup_capacity]                 at lookup_offset, slots of room_lookup_t
+//   char[strings_size]                        at strings_offset, names and descriptions without terminators
+//   map_tile_t[map_tile_count]                at map_offset
+//
+// Loading it is a single read plus turning offsets into String_Views. The
+// exits, the name lookup table and the map tiles are used in place, so nothing
+// gets parsed or hashed.
+#define TAC_MAGIC "TAC\x1a"
+#define TAC_VERSION 5
+#define TAC_BYTE_ORDER 0x01020304u
+#define TAC_UNDEFINED UINT32_MAX
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  // TAC_BYTE_ORDER as the writer stored it, the tables are used in place and
+  // are never byte swapped
+  uint32_t byte_order;
+  uint32_t room_count;
+  uint32_t rooms_offset;
+  uint32_t start_room;
+  uint32_t edge_count;
+  uint32_t edge_offsets_offset;
+  uint32_t edges_offset;
+  uint32_t direction_count;
+  uint32_t directions_offset;
+  uint32_t lookup_capacity;
+  uint32_t lookup_offset;
+  uint32_t strings_offset;
+  uint32_t strings_size;
+  uint32_t map_width;
+  uint32_t map_height;
+  uint32_t map_tile_count;
+  uint32_t map_offset;
+} tac_header_t;
+
+typedef struct {
+  // TAC_UNDEFINED for descriptions of rooms that are only referenced
+  uint32_t offset;
+  uint32_t length;
+} tac_string_t;
+
+typedef struct {
+  tac_string_t name;
+  tac_string_t description;
+} tac_room_t;
+
+static tac_string_t tac_append_string(String_Builder *strings, String_View sv) {
+  if (sv.data == NULL) return (tac_string_t){ .offset = TAC_UNDEFINED };
+  tac_string_t result = { .offset = (uint32_t)strings->count, .length = (uint32_t)sv.count };
+  sb_append_buf(strings, sv.data, sv.count);
+  return result;
+}
+
+static bool tac_read_string(const char *strings, uint32_t strings_size, tac_string_t string, String_View *dest) {
+  *dest = (String_View){0};
+  if (string.offset == TAC_UNDEFINED) return true;
+  if ((uint64_t)string.offset + string.length > strings_size) return false;
+  *dest = sv_from_parts(strings + string.offset, string.length);
+  return true;
+}
+
+static bool write_compiled_adventure_file(const adventure_t *adventure, const char *filename) {
+  bool result = true;
+  String_Builder out = {};
+  String_Builder strings = {};
+  struct {
+    tac_room_t *items;
+    size_t count;
+    size_t capacity;
+  } rooms = {};
+  struct {
+    tac_string_t *items;
+    size_t count;
+    size_t capacity;
+  } directions = {};
+
+  // Interned descriptions are written once and shared by offset
+  pointer_map_t written;
+  pointer_map_init(&written, room_count(adventure));
+  for (size_t i = 0; i < room_count(adventure); ++i) {
+    tac_room_t tac_room = { .name = tac_append_string(&strings, adventure->names.items[i]) };
+    const char *stored = adventure->descriptions.items[i].data;
+    bool found = false;
+    uint32_t *first = stored != NULL ? pointer_map_slot(&written, stored, &found) : NULL;
+    if (found) {
+      tac_room.description = rooms.items[*first].description;
+    } else {
+      tac_room.description = tac_append_string(&strings, room_description(adventure, (uint32_t)i));
+      if (first != NULL) *first = (uint32_t)i;
+    }
+    da_append(&rooms, tac_room);
+  }
+  pointer_map_free(&written);
+  for (size_t i = 0; i < adventure->directions.count; ++i)
+    da_append(&directions, tac_append_string(&strings, adventure->directions.items[i]));
+
+  tac_header_t header = {
+    .version = TAC_VERSION,
+    .byte_order = TAC_BYTE_ORDER,
+    .room_count = (uint32_t)rooms.count,
+    .rooms_offset = sizeof(tac_header_t),
+    .start_room = adventure->start_room,
+    .edge_count = (uint32_t)adventure->edge_count,
+    .direction_count = (uint32_t)directions.count,
+    .lookup_capacity = (uint32_t)adventure->lookup.capacity,
+    .map_width = adventure->map.width,
+    .map_height = adventure->map.height,
+    .map_tile_count = (uint32_t)adventure->map.count,
+  };
+  memcpy(header.magic, TAC_MAGIC, sizeof(header.magic));
+  header.edge_offsets_offset = header.rooms_offset + (uint32_t)(rooms.count * sizeof(tac_room_t));
+  header.edges_offset = header.edge_offsets_offset + (header.room_count + 1) * (uint32_t)sizeof(uint32_t);
+  header.directions_offset = header.edges_offset + header.edge_count * (uint32_t)sizeof(edge_t);
+  header.lookup_offset = header.directions_offset + header.direction_count * (uint32_t)sizeof(tac_string_t);
+  header.strings_offset = header.lookup_offset + header.lookup_capacity * (uint32_t)sizeof(uint32_t);
+  header.strings_size = (uint32_t)strings.count;
+  // Tiles are used in place, keep them aligned
+  header.map_offset = (header.strings_offset + header.strings_size + 3) & ~3u;
+
+  sb_append_buf(&out, &header, sizeof(header));
+  sb_append_buf(&out, rooms.items, rooms.count * sizeof(tac_room_t));
+  sb_append_buf(&out, adventure->edge_offsets, (room_count(adventure) + 1) * sizeof(uint32_t));
+  sb_append_buf(&out, adventure->edges, adventure->edge_count * sizeof(edge_t));
+  sb_append_buf(&out, directions.items, directions.count * sizeof(tac_string_t));
+  sb_append_buf(&out, adventure->lookup.slots, adventure->lookup.capacity * sizeof(uint32_t));
+  sb_append_buf(&out, strings.items, strings.count);
+  while (out.count < header.map_offset) da_append(&out, '\0');
+  for (size_t i = 0; i < adventure->map.capacity; ++i)
+    if (adventure->map.slots[i] != NULL)
+      sb_append_buf(&out, adventure->map.slots[i], sizeof(map_tile_t));
+
+  // Adventures loaded from it keep their copy, loads that run meanwhile must
+  // not see it half written
+  const char *temp = temp_sprintf("%s.tmp", filename);
+  if (!write_entire_file(temp, out.items, out.count)) return_defer(false);
+  if (!replace_file(temp, filename)) {
+    remove(temp);
+    return_defer(false);
+  }
+
+defer:
+  sb_free(out);
+  sb_free(strings);
+  da_free(rooms);
+  da_free(directions);
+  return result;
+}
+
+static bool read_compiled_adventure_file(const char *filename, adventure_t *dest) {
+  bool result = true;
+  *dest = (adventure_t){0};
+
+  if (!read_file_copy(filename, &dest->source)) error_read(filename);
+
+  const char *base = dest->source.data;
+  size_t size = dest->source.size;
+  if (size < sizeof(tac_header_t)) error_invalid(filename);
+
+  tac_header_t header;
+  memcpy(&header, base, sizeof(header));
+  if (memcmp(header.magic, TAC_MAGIC, sizeof(header.magic)) != 0) error_invalid(filename);
+  if (header.version != TAC_VERSION) error_invalid(filename);
+  if (header.byte_order != TAC_BYTE_ORDER) error_invalid(filename);
+  if (header.start_room >= header.room_count) error_invalid(filename);
+  if (header.lookup_capacity < 2 * (uint64_t)header.room_count) error_invalid(filename);
+  if ((header.lookup_capacity & (header.lookup_capacity - 1)) != 0) error_invalid(filename);
+  if ((header.edge_offsets_offset | header.edges_offset | header.lookup_offset | header.map_offset) % 4 != 0) error_invalid(filename);
+  if ((uint64_t)header.rooms_offset + (uint64_t)header.room_count * sizeof(tac_room_t) > size) error_invalid(filename);
+  if ((uint64_t)header.edge_offsets_offset + ((uint64_t)header.room_count + 1) * sizeof(uint32_t) > size) error_invalid(filename);
+  if ((uint64_t)header.edges_offset + (uint64_t)header.edge_count * sizeof(edge_t) > size) error_invalid(filename);
+  if ((uint64_t)header.directions_offset + (uint64_t)header.direction_count * sizeof(tac_string_t) > size) error_invalid(filename);
+  if ((uint64_t)header.lookup_offset + (uint64_t)header.lookup_capacity * sizeof(uint32_t) > size) error_invalid(filename);
+  if ((uint64_t)header.strings_offset + header.strings_size > size) error_invalid(filename);
+  if ((uint64_t)header.map_offset + (uint64_t)header.map_tile_count * sizeof(map_tile_t) > size) error_invalid(filename);
+
+  dest->start_room = header.start_room;
+  dest->edge_offsets = (uint32_t *)(base + header.edge_offsets_offset);
+  dest->edge_ends = dest->edge_offsets + 1;
+  dest->edges = (edge_t *)(base + header.edges_offset);
+  dest->edge_count = header.edge_count;
+  dest->lookup.slots = (uint32_t *)(base + header.lookup_offset);
+  dest->lookup.capacity = header.lookup_capacity;
+
+  // find_room() probes until it meets an empty slot, a table without one
+  // would never let it stop
+  size_t empty_slots = 0;
+  for (size_t i = 0; i < dest->lookup.capacity; ++i) {
+    if (dest->lookup.slots[i] == NO_ROOM) empty_slots++;
+    else if (dest->lookup.slots[i] >= header.room_count) error_invalid(filename);
+  }
+  if (empty_slots == 0) error_invalid(filename);
+  if (dest->edge_offsets[0] != 0 || dest->edge_offsets[header.room_count] != header.edge_count) error_invalid(filename);
+  for (uint32_t i = 0; i < header.room_count; ++i)
+    if (dest->edge_offsets[i] > dest->edge_offsets[i + 1]) error_invalid(filename);
+  for (uint32_t i = 0; i < header.edge_count; ++i)
+    if (dest->edges[i].target >= header.room_count || dest->edges[i].direction >= header.direction_count) error_invalid(filename);
+
+  const char *strings = base + header.strings_offset;
+  for (uint32_t i = 0; i < header.direction_count; ++i) {
+    tac_string_t tac_direction;
+    String_View direction;
+    memcpy(&tac_direction, base + header.directions_offset + i * sizeof(tac_string_t), sizeof(tac_direction));
+    if (!tac_read_string(strings, header.strings_size, tac_direction, &direction)) error_invalid(filename);
+    arena_da_append(&dest->arena, &dest->directions, direction);
+  }
+
+  // Strings are written in room order, so a description is new exactly when
+  // it lies past every description before it
+  int64_t last_description = -1;
+  for (uint32_t i = 0; i < header.room_count; ++i) {
+    tac_room_t tac_room;
+    String_View name, description;
+    memcpy(&tac_room, base + header.rooms_offset + i * sizeof(tac_room_t), sizeof(tac_room));
+    if (!tac_read_string(strings, header.strings_size, tac_room.name, &name)) error_invalid(filename);
+    if (!tac_read_string(strings, header.strings_size, tac_room.description, &description)) error_invalid(filename);
+    arena_da_append(&dest->arena, &dest->names, name);
+    arena_da_append(&dest->arena, &dest->descriptions, description);
+    if (description.data != NULL && (int64_t)tac_room.description.offset > last_description) {
+      last_description = tac_room.description.offset;
+      dest->unique_descriptions++;
+    }
+  }
+
+  const map_tile_t *tiles = (const map_tile_t *)(base + header.map_offset);
+  for (uint32_t i = 0; i < header.map_tile_count; ++i) {
+    if (map_find_tile(&dest->map, tiles[i].x, tiles[i].y) != NULL) error_invalid(filename);
+    map_insert_tile(&dest->arena, &dest->map, &tiles[i]);
+  }
+  dest->map.width = header.map_width;
+  dest->map.height = header.map_height;
+
+defer:
+  if (!result) free_adventure(dest);
+  return result;
+}
+
+// Adventure validation, used by ta-check and by loads with --check. Every pass
+// is linear in rooms plus exits: exits into rooms that are never defined,
+// rooms the start room can not reach, Tarjan's strongly connected components
+// to find places with no way back out, and the exits of rooms drawn on the
+// map against where the map puts them. Problems are logged, undefined rooms
+// as errors and everything else as warnings.
+#define CHECK_MAX_REPORTED 10
+
+// Set with --check, adventures with errors are refused then
+static bool check_on_load = false;
+
+typedef struct {
+  size_t errors;
+  size_t warnings;
+} check_result_t;
+
+typedef struct {
+  uint32_t room;
+  uint32_t edge;
+} check_frame_t;
+
+static const struct {
+  const char *name;
+  int dx, dy;
+} check_compass[] = {
+  { "north", 0, -1 }, { "east", 1, 0 }, { "south", 0, 1 }, { "west", -1, 0 },
+  { "northeast", 1, -1 }, { "northwest", -1, -1 }, { "southeast", 1, 1 }, { "southwest", -1, 1 },
+};
+
+static inline bool room_defined(const adventure_t *adventure, uint32_t room) {
+  return adventure->descriptions.items[room].data != NULL;
+}
+
+// Logs the first CHECK_MAX_REPORTED problems of a kind and counts the rest
+static void check_report(size_t *count, const char *message) {
+  if ((*count)++ < CHECK_MAX_REPORTED) log_message(message);
+}
+
+static void check_report_rest(size_t count, const char *what) {
+  if (count > CHECK_MAX_REPORTED)
+    log_message(temp_sprintf(COLOR_YELLOW"... and %zu more %s", count - CHECK_MAX_REPORTED, what));
+}
+
+static void check_map(const adventure_t *adventure, check_result_t *result) {
+  // Only rooms with single character names can be drawn on the map
+  uint32_t rooms[256], xs[256], ys[256], drawn[256] = {0};
+  for (int c = 1; c < 256; ++c) {
+    char name = (char)c;
+    rooms[c] = find_room(adventure, sv_from_parts(&name, 1));
+  }
+  for (size_t i = 0; i < adventure->map.capacity; ++i) {
+    const map_tile_t *tile = adventure->map.slots[i];
+    if (tile == NULL) continue;
+    for (uint32_t y = 0; y < MAP_TILE_SIZE; ++y) {
+      for (uint32_t x = 0; x < MAP_TILE_SIZE; ++x) {
+        unsigned char c = (unsigned char)tile->cells[y][x];
+        if (c == 0 || rooms[c] == NO_ROOM) continue;
+        drawn[c]++;
+        xs[c] = tile->x * MAP_TILE_SIZE + x;
+        ys[c] = tile->y * MAP_TILE_SIZE + y;
+      }
+    }
+  }
+
+  int32_t offsets[2][256];
+  bool compass[256] = {0};
+  for (size_t i = 0; i < adventure->directions.count && i < 256; ++i) {
+    for (size_t j = 0; j < ARRAY_LEN(check_compass); ++j) {
+      if (!sv_eq(adventure->directions.items[i], SV(check_compass[j].name))) continue;
+      compass[i] = true;
+      offsets[0][i] = check_compass[j].dx;
+      offsets[1][i] = check_compass[j].dy;
+    }
+  }
+
+  size_t count = 0;
+  for (int c = 1; c < 256; ++c) {
+    if (drawn[c] == 0) continue;
+    uint32_t room = rooms[c];
+    if (drawn[c] > 1) {
+      check_report(&count, temp_sprintf(COLOR_YELLOW"Warning: room %c is drawn %u times on the map", c, drawn[c]));
+      continue;
+    }
+    if (!room_defined(adventure, room)) {
+      check_report(&count, temp_sprintf(COLOR_YELLOW"Warning: the map shows room %c, which is never defined", c));
+      continue;
+    }
+    for (uint32_t e = adventure->edge_offsets[room]; e < adventure->edge_ends[room]; ++e) {
+      edge_t edge = adventure->edges[e];
+      String_View target = adventure->names.items[edge.target];
+      if (edge.direction >= 256 || !compass[edge.direction] || target.count != 1) continue;
+      unsigned char t = (unsigned char)target.data[0];
+      if (drawn[t] != 1) continue;
+      int64_t x = (int64_t)xs[c] + offsets[0][edge.direction];
+      int64_t y = (int64_t)ys[c] + offsets[1][edge.direction];
+      if (x == xs[t] && y == ys[t]) continue;
+      check_report(&count, temp_sprintf(COLOR_YELLOW"Warning: the "SV_Fmt" exit of %c leads to %c, which the map draws at %u,%u instead of %lld,%lld",
+                                        SV_Arg(adventure->directions.items[edge.direction]), c, t,
+                                        xs[t], ys[t], (long long)x, (long long)y));
+    }
+  }
+  check_report_rest(count, "map problems");
+  result->warnings += count;
+}
+
+static check_result_t check_adventure(const adventure_t *adventure) {
+  check_result_t result = {0};
+  size_t rooms = room_count(adventure);
+  const uint32_t start = adventure->start_room;
+  // Tarjan's DFS numbers start at 1, 0 is unvisited. A visited room is on
+  // the stack for as long as it has no component.
+  uint32_t *order = calloc(rooms, sizeof(uint32_t));
+  uint32_t *low = malloc(rooms * sizeof(uint32_t));
+  uint32_t *component = malloc(rooms * sizeof(uint32_t));
+  uint32_t *stack = malloc(rooms * sizeof(uint32_t));
+  uint32_t *sizes = malloc(rooms * sizeof(uint32_t));
+  check_frame_t *calls = malloc(rooms * sizeof(check_frame_t));
+  assert(order != NULL && low != NULL && component != NULL && stack != NULL && sizes != NULL && calls != NULL);
+
+  // Undefined rooms, each with the first exit that leads there and its room
+  uint32_t *first_edge = low, *first_from = stack;
+  for (size_t i = 0; i < rooms; ++i) first_edge[i] = NO_ROOM;
+  for (uint32_t room = 0; room < rooms; ++room) {
+    for (uint32_t e = adventure->edge_offsets[room]; e < adventure->edge_ends[room]; ++e) {
+      uint32_t target = adventure->edges[e].target;
+      if (first_edge[target] != NO_ROOM) continue;
+      first_edge[target] = e;
+      first_from[target] = room;
+    }
+  }
+  size_t count = 0;
+  for (uint32_t room = 0; room < rooms; ++room) {
+    if (room_defined(adventure, room) || first_edge[room] == NO_ROOM) continue;
+    check_report(&count, temp_sprintf(COLOR_RED"Error: room "SV_Fmt" is never defined, the "SV_Fmt" exit of "SV_Fmt" leads there",
+                                      SV_Arg(adventure->names.items[room]),
+                                      SV_Arg(adventure->directions.items[adventure->edges[first_edge[room]].direction]),
+                                      SV_Arg(adventure->names.items[first_from[room]])));
+  }
+  check_report_rest(count, "undefined rooms");
+  result.errors += count;
+
+  // Tarjan from the start room, with an explicit call stack
+  for (size_t i = 0; i < rooms; ++i) component[i] = NO_ROOM;
+  uint32_t counter = 0, components = 0;
+  size_t stack_count = 0, depth = 0;
+  order[start] = low[start] = ++counter;
+  stack[stack_count++] = start;
+  calls[depth++] = (check_frame_t){ start, adventure->edge_offsets[start] };
+  while (depth > 0) {
+    check_frame_t *frame = &calls[depth - 1];
+    uint32_t room = frame->room;
+    if (frame->edge < adventure->edge_ends[room]) {
+      uint32_t target = adventure->edges[frame->edge++].target;
+      if (order[target] == 0) {
+        order[target] = low[target] = ++counter;
+        stack[stack_count++] = target;
+        calls[depth++] = (check_frame_t){ target, adventure->edge_offsets[target] };
+      } else if (component[target] == NO_ROOM && order[target] < low[room]) {
+        low[room] = order[target];
+      }
+      continue;
+    }
+
+    if (low[room] == order[room]) {
+      uint32_t member, size = 0;
+      do {
+        member = stack[--stack_count];
+        component[member] = components;
+        size++;
+      } while (member != room);
+      sizes[components++] = size;
+    }
+    depth--;
+    if (depth > 0 && low[room] < low[calls[depth - 1].room]) low[calls[depth - 1].room] = low[room];
+  }
+
+  count = 0;
+  for (uint32_t room = 0; room < rooms; ++room)
+    if (order[room] == 0 && room_defined(adventure, room))
+      check_report(&count, temp_sprintf(COLOR_YELLOW"Warning: room "SV_Fmt" can not be reached from the start room",
+                                        SV_Arg(adventure->names.items[room])));
+  check_report_rest(count, "unreachable rooms");
+  result.warnings += count;
+
+  // Every reachable room that can get back to the start shares its
+  // component, which is the last one finished. Components without exits to
+  // other components are traps: once entered they can not be left.
+  uint32_t start_component = component[start];
+  uint32_t *leaves = stack;
+  memset(leaves, 0, components * sizeof(uint32_t));
+  size_t stranded = 0;
+  for (uint32_t room = 0; room < rooms; ++room) {
+    if (order[room] == 0) continue;
+    if (component[room] != start_component && room_defined(adventure, room)) stranded++;
+    for (uint32_t e = adventure->edge_offsets[room]; e < adventure->edge_ends[room]; ++e)
+      if (component[adventure->edges[e].target] != component[room]) leaves[component[room]] = 1;
+  }
+  count = 0;
+  for (uint32_t room = 0; room < rooms; ++room) {
+    uint32_t c = component[room];
+    if (order[room] == 0 || c == start_component || leaves[c] != 0 || !room_defined(adventure, room)) continue;
+    leaves[c] = 1;
+    if (sizes[c] == 1)
+      check_report(&count, temp_sprintf(COLOR_YELLOW"Warning: room "SV_Fmt" is a dead end with no way out",
+                                        SV_Arg(adventure->names.items[room])));
+    else
+      check_report(&count, temp_sprintf(COLOR_YELLOW"Warning: the %u rooms around "SV_Fmt" have no way out once entered",
+                                        sizes[c], SV_Arg(adventure->names.items[room])));
+  }
+  check_report_rest(count, "dead ends");
+  result.warnings += count;
+  if (stranded > 0) {
+    log_message(temp_sprintf(COLOR_YELLOW"Warning: %zu reachable rooms have no way back to the start room", stranded));
+    result.warnings++;
+  }
+
+  check_map(adventure, &result);
+
+  free(order);
+  free(low);
+  free(component);
+  free(stack);
+  free(sizes);
+  free(calls);
+  return result;
+}
+
+static inline uint64_t monotonic_nanos(void) {
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif //_WIN32
+}
+
+// Nanoseconds since the Unix epoch
+static inline int64_t realtime_nanos(void) {
+#ifdef _WIN32
+  FILETIME ft;
+  GetSystemTimeAsFileTime(&ft);
+  // 100ns ticks since 1601
+  return ((int64_t)(((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime) - 116444736000000000ll) * 100;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+#endif //_WIN32
+}
+
+// Adventures loaded so far, most recently used first. An entry is reused when
+// the canonical path, size and modification time of the file still match, so
+// loading an unchanged adventure again is a pointer swap. Entries past the
+// memory budget are dropped from the tail, except the one in use.
+#define ADVENTURE_CACHE_DEFAULT_BUDGET (256*1024*1024)
+
+typedef struct adventure_cache_entry_t adventure_cache_entry_t;
+
+struct adventure_cache_entry_t {
+  adventure_cache_entry_t *prev, *next;
+  char *path;
+  uint64_t size;
+  int64_t mtime_ns;
+  // Arena bytes in use plus the file copy, see adventure_bytes()
+  size_t bytes;
+  // The file changed since, dropped as soon as it is not in use
+  bool stale;
+  adventure_t adventure;
+};
+
+static struct {
+  adventure_cache_entry_t *head, *tail;
+  size_t count;
+  size_t bytes, budget;
+  uint64_t hits, misses, evictions;
+} adventure_cache = { .budget = ADVENTURE_CACHE_DEFAULT_BUDGET };
+
+// The adventure every session plays, it lives in the cache
+static adventure_t *adventure = NULL;
+// Set by the server, every session shares the one adventure it loaded
+static bool adventure_read_only = false;
+
+static void adventure_cache_unlink(adventure_cache_entry_t *entry) {
+  if (entry->prev) entry->prev->next = entry->next;
+  else adventure_cache.head = entry->next;
+  if (entry->next) entry->next->prev = entry->prev;
+  else adventure_cache.tail = entry->prev;
+  entry->prev = entry->next = NULL;
+}
+
+static void adventure_cache_push_front(adventure_cache_entry_t *entry) {
+  entry->next = adventure_cache.head;
+  if (adventure_cache.head) adventure_cache.head->prev = entry;
+  adventure_cache.head = entry;
+  if (adventure_cache.tail == NULL) adventure_cache.tail = entry;
+}
+
+static void adventure_cache_drop(adventure_cache_entry_t *entry) {
+  adventure_cache_unlink(entry);
+  adventure_cache.count--;
+  adventure_cache.bytes -= entry->bytes;
+  free_adventure(&entry->adventure);
+  free(entry->path);
+  free(entry);
+}
+
+// What the arena hands out rather than what it reserves: a region is as large
+// as all before it, and the untouched rest of it never becomes resident. A lazy
+// adventure's first few parsed rooms would double its charge otherwise.
+static size_t adventure_bytes(const adventure_t *cached) {
+  return cached->arena.used + cached->source.size;
+}
+
+// Brings the size of the entry holding `cached` up to date, lazy adventures
+// keep growing as their rooms are parsed
+static void adventure_cache_account(const adventure_t *cached) {
+  for (adventure_cache_entry_t *entry = adventure_cache.head; entry != NULL; entry = entry->next) {
+    if (&entry->adventure != cached) continue;
+    adventure_cache.bytes -= entry->bytes;
+    entry->bytes = adventure_bytes(cached);
+    adventure_cache.bytes += entry->bytes;
+    return;
+  }
+}
+
+// Drops stale entries, then evicts least recently used entries until the
+// cache fits its budget
+static void adventure_cache_trim(void) {
+  adventure_cache_entry_t *entry = adventure_cache.tail;
+  while (entry != NULL) {
+    adventure_cache_entry_t *prev = entry->prev;
+    if (entry->stale && &entry->adventure != adventure) adventure_cache_drop(entry);
+    entry = prev;
+  }
+
+  entry = adventure_cache.tail;
+  while (entry != NULL && adventure_cache.bytes > adventure_cache.budget) {
+    adventure_cache_entry_t *prev = entry->prev;
+    if (&entry->adventure != adventure) {
+      adventure_cache_drop(entry);
+      adventure_cache.evictions++;
+    }
+    entry = prev;
+  }
+}
+
+static const char *adventure_cache_path(const adventure_t *cached) {
+  for (adventure_cache_entry_t *entry = adventure_cache.head; entry != NULL; entry = entry->next)
+    if (&entry->adventure == cached) return entry->path;
+  return NULL;
+}
+
+static char *canonical_path(const char *path) {
+#ifdef _WIN32
+  return _fullpath(NULL, path, 0);
+#else
+  return realpath(path, NULL);
+#endif //_WIN32
+}
+
+// Set with --lazy, .ta files are only indexed on load, see read_adventure_source()
+static bool lazy_on_load = false;
+
+// Loads <name>.tac when it is at least as new as <name>.ta, otherwise parses
+// <name>.ta, either way through the cache
+static adventure_t *load_adventure(String_View name, const char **loaded_filename, bool *cached) {
+  const char *source = temp_sprintf(SV_Fmt".ta", SV_Arg(name));
+  const char *compiled = temp_sprintf(SV_Fmt".tac", SV_Arg(name));
+
+  bool use_compiled = file_exists(compiled) == 1 &&
+    (file_exists(source) != 1 || needs_rebuild1(compiled, source) == 0);
+  const char *filename = use_compiled ? compiled : source;
+  *loaded_filename = filename;
+  *cached = false;
+
+  struct stat st;
+  char *path = canonical_path(filename);
+  if (path == NULL || stat(path, &st) < 0) {
+    free(path);
+    log_message(temp_sprintf(COLOR_RED"Error: could not read adventure file: %s", filename));
+    return NULL;
+  }
+#ifdef __linux__
+  int64_t mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+  int64_t mtime_ns = (int64_t)st.st_mtime * 1000000000;
+#endif //__linux__
+
+  for (adventure_cache_entry_t *entry = adventure_cache.head; entry != NULL; entry = entry->next) {
+    if (entry->stale || strcmp(entry->path, path) != 0) continue;
+    if (entry->size == (uint64_t)st.st_size && entry->mtime_ns == mtime_ns) {
+      adventure_cache_unlink(entry);
+      adventure_cache_push_front(entry);
+      adventure_cache.hits++;
+      *cached = true;
+      free(path);
+      return &entry->adventure;
+    }
+    // The file changed, the old version is of no use any more
+    if (&entry->adventure != adventure) adventure_cache_drop(entry);
+    else entry->stale = true;
+    break;
+  }
+
+  adventure_cache.misses++;
+  adventure_cache_entry_t *entry = malloc(sizeof(*entry));
+  if (entry == NULL) {
+    free(path);
+    return NULL;
+  }
+  *entry = (adventure_cache_entry_t){
+    .path = path,
+    .size = (uint64_t)st.st_size,
+    .mtime_ns = mtime_ns,
+  };
+  bool ok = use_compiled
+    ? read_compiled_adventure_file(filename, &entry->adventure)
+    : read_adventure_source(filename, &entry->adventure, lazy_on_load);
+  // Checks and compression look at every room anyway
+  if (ok && (check_on_load || compress_on_load)) adventure_parse_all(&entry->adventure);
+  if (ok && check_on_load && check_adventure(&entry->adventure).errors > 0) {
+    log_message(temp_sprintf(COLOR_RED"Error: %s did not pass the checks", filename));
+    free_adventure(&entry->adventure);
+    ok = false;
+  }
+  if (!ok) {
+    free(path);
+    free(entry);
+    return NULL;
+  }
+  if (compress_on_load) {
+    size_t plain = 0;
+    for (size_t i = 0; i < room_count(&entry->adventure); ++i) plain += entry->adventure.descriptions.items[i].count;
+    uint64_t start = monotonic_nanos();
+    size_t compressed = compress_descriptions(&entry->adventure);
+    detach_source(&entry->adventure);
+    log_message(temp_sprintf(COLOR_YELLOW"Info: descriptions compressed from %zu KiB to %zu KiB (%.1fx, dictionary included) in %.1f ms",
+                             plain / 1024, compressed / 1024, compressed > 0 ? (double)plain / compressed : 0.0,
+                             (monotonic_nanos() - start) / 1e6));
+  }
+
+  entry->bytes = adventure_bytes(&entry->adventure);
+  adventure_cache_push_front(entry);
+  adventure_cache.count++;
+  adventure_cache.bytes += entry->bytes;
+  return &entry->adventure;
+}
+
+static int compile_adventures(int argc, char **argv) {
+  int status = 0;
+  while (argc > 0) {
+    const char *source = shift_args(&argc, &argv);
+    String_View name = SV(source);
+    if (sv_end_with(name, ".ta")) name.count -= 3;
+    const char *compiled = temp_sprintf(SV_Fmt".tac", SV_Arg(name));
+
+    adventure_t compiled_adventure;
+    if (!read_adventure_file(source, &compiled_adventure)) {
+      fprintf(stderr, SV_Fmt COLOR_RESET"\n", SV_Arg(message_text(message_log_at(message_log.count - 1))));
+      status = 1;
+      continue;
+    }
+    if (!write_compiled_adventure_file(&compiled_adventure, compiled)) status = 1;
+    else printf("%s -> %s\n", source, compiled);
+    free_adventure(&compiled_adventure);
+  }
+  return status;
+}
+
+// Latency histograms, compiled in with -DTAE_STATS (nob does that for debug
+// builds and for release builds with --stats). Buckets are log-linear: values
+// below 2^LATENCY_SUB_BITS ns get one bucket each, above that every power of
+// two is split into 2^LATENCY_SUB_BITS buckets, so any recorded value is
+// within about 3% of its bucket. Recording is a clz, a shift and an increment.
+#define LATENCY_SUB_BITS 5
+#define LATENCY_SUB_COUNT (1u << LATENCY_SUB_BITS)
+#define LATENCY_BUCKET_COUNT ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_COUNT)
+#define LATENCY_HISTOGRAM_CAPACITY 32
+
+typedef struct {
+  const char *name;
+  uint64_t count;
+  uint64_t max;
+  uint64_t buckets[LATENCY_BUCKET_COUNT];
+} latency_histogram_t;
+
+#ifdef TAE_STATS
+static struct {
+  latency_histogram_t items[LATENCY_HISTOGRAM_CAPACITY];
+  size_t count;
+} latency_histograms = {};
+
+static latency_histogram_t *frame_histogram = NULL;
+
+static inline size_t latency_bucket(uint64_t nanos) {
+  if (nanos < LATENCY_SUB_COUNT) return (size_t)nanos;
+  int shift = 63 - __builtin_clzll(nanos) - LATENCY_SUB_BITS;
+  return (size_t)(shift + 1) * LATENCY_SUB_COUNT + (size_t)((nanos >> shift) - LATENCY_SUB_COUNT);
+}
+
+// Largest value that lands in `bucket`
+static inline uint64_t latency_bucket_high(size_t bucket) {
+  if (bucket < LATENCY_SUB_COUNT) return bucket;
+  int shift = (int)(bucket / LATENCY_SUB_COUNT) - 1;
+  uint64_t sub = bucket % LATENCY_SUB_COUNT + LATENCY_SUB_COUNT;
+  return ((sub + 1) << shift) - 1;
+}
+
+static latency_histogram_t *latency_histogram_new(const char *name) {
+  assert(latency_histograms.count < LATENCY_HISTOGRAM_CAPACITY);
+  latency_histogram_t *histogram = &latency_histograms.items[latency_histograms.count++];
+  histogram->name = name;
+  return histogram;
+}
+
+static inline void latency_record(latency_histogram_t *histogram, uint64_t nanos) {
+  histogram->buckets[latency_bucket(nanos)]++;
+  histogram->count++;
+  if (nanos > histogram->max) histogram->max = nanos;
+}
+
+static uint64_t latency_percentile(const latency_histogram_t *histogram, double percentile) {
+  uint64_t rank = (uint64_t)(percentile / 100.0 * (double)histogram->count + 0.5);
+  if (rank == 0) rank = 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+    seen += histogram->buckets[i];
+    if (seen >= rank) {
+      uint64_t high = latency_bucket_high(i);
+      return high < histogram->max ? high : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+#define STATS_BEGIN(start) uint64_t start = monotonic_nanos()
+#define STATS_END(histogram, start) latency_record((histogram), monotonic_nanos() - (start))
+#else
+#define STATS_BEGIN(start) ((void)0)
+#define STATS_END(histogram, start) ((void)0)
+#endif // TAE_STATS
+
+
+// Everything a single player has on top of the shared adventure
+typedef struct {
+  bool adventure_loaded;
+  uint32_t current_room;
+  bool exit_requested;
+} session_t;
+
+// Handlers get the arguments after the verb, already lowercased
+typedef void (command_handler_t)(session_t *session, String_View args);
+
+typedef struct {
+  String_View name;
+  command_handler_t *handler;
+#ifdef TAE_STATS
+  // Shared by a verb and its aliases
+  latency_histogram_t *histogram;
+#endif // TAE_STATS
+} command_t;
+
+// Open addressing table from verb to handler. It is filled once at startup
+// and kept at most half full, so a lookup is one hash and almost always a
+// single comparison no matter how many verbs there are.
+#define COMMAND_TABLE_CAPACITY 256
+
+static struct {
+  command_t slots[COMMAND_TABLE_CAPACITY];
+  size_t count;
+} commands = {};
+
+// Registers `name` as a verb or an alias, fails when it is already taken
+static bool register_command(const char *name, command_handler_t *handler) {
+  String_View sv = SV(name);
+  if ((commands.count + 1) * 2 > COMMAND_TABLE_CAPACITY) return false;
+
+  size_t mask = COMMAND_TABLE_CAPACITY - 1;
+  size_t i = hash_string(sv) & mask;
+  for (; commands.slots[i].handler != NULL; i = (i + 1) & mask)
+    if (sv_eq(commands.slots[i].name, sv)) return false;
+  commands.slots[i] = (command_t){ .name = sv, .handler = handler };
+  commands.count++;
+
+#ifdef TAE_STATS
+  // Aliases are timed together under the first name registered
+  for (size_t j = 0; j < COMMAND_TABLE_CAPACITY; ++j) {
+    if (j != i && commands.slots[j].handler == handler) {
+      commands.slots[i].histogram = commands.slots[j].histogram;
+      return true;
+    }
+  }
+  commands.slots[i].histogram = latency_histogram_new(name);
+#endif // TAE_STATS
+  return true;
+}
+
+static const command_t *find_command(String_View name) {
+  size_t mask = COMMAND_TABLE_CAPACITY - 1;
+  for (size_t i = hash_string(name) & mask; commands.slots[i].handler != NULL; i = (i + 1) & mask)
+    if (sv_eq(commands.slots[i].name, name)) return &commands.slots[i];
+  return NULL;
+}
+
+#ifdef __linux__
+// Watch mode keeps its own copy of the adventure, read into memory so that
+// edits to the file can not shift the text under it, and a snapshot of the
+// file as last parsed. When inotify reports a write, the new file is compared
+// against the snapshot and only the room lines between the first and the last
+// differing byte are parsed again. Everything else, including room indices,
+// stays as it is. Edits outside the rooms section fall back to a full parse.
+#define WATCH_EVENT_BUF_SIZE 4096
+
+static struct {
+  bool active;
+  // watch.adventure is the one in use until the next load
+  bool owns_adventure;
+  int inotify_fd;
+  char *path;
+  // File name part of `path`, events come for the whole directory
+  const char *name;
+  adventure_t adventure;
+  // Copy of the file as it was last parsed, patched along with the rooms
+  char *snapshot;
+  size_t snapshot_size, snapshot_capacity;
+  // Offsets of the first room line and of the smoor line in the snapshot
+  size_t rooms_begin, rooms_end;
+  // Writable exit arrays standing in for the packed CSR
+  uint32_t *starts, *ends;
+  size_t rooms_capacity;
+  edge_t *edges;
+  size_t edges_capacity;
+} watch = { .inotify_fd = -1 };
+
+static void watch_free_snapshot(void) {
+  free(watch.snapshot);
+  watch.snapshot = NULL;
+  watch.snapshot_size = watch.snapshot_capacity = 0;
+}
+
+// Replaces [begin, old_end) of the snapshot with [begin, new_end) of `data`
+static void watch_patch_snapshot(const char *data, size_t begin, size_t old_end, size_t new_end) {
+  size_t tail = watch.snapshot_size - old_end;
+  size_t size = new_end + tail;
+  if (size > watch.snapshot_capacity) {
+    size_t capacity = watch.snapshot_capacity + watch.snapshot_capacity / 2;
+    if (capacity < size) capacity = size;
+    watch.snapshot = realloc(watch.snapshot, capacity);
+    assert(watch.snapshot != NULL && "Buy more RAM lol");
+    watch.snapshot_capacity = capacity;
+  }
+  memmove(watch.snapshot + new_end, watch.snapshot + old_end, tail);
+  memcpy(watch.snapshot + begin, data + begin, new_end - begin);
+  watch.snapshot_size = size;
+}
+
+static void watch_free_adventure(void) {
+  watch_free_snapshot();
+  free(watch.starts);
+  free(watch.ends);
+  free(watch.edges);
+  watch.starts = watch.ends = NULL;
+  watch.edges = NULL;
+  watch.rooms_capacity = watch.edges_capacity = 0;
+  free_adventure(&watch.adventure);
+  watch.owns_adventure = false;
+}
+
+// Stops watching, the adventure stays loaded until watch_release()
+static void watch_stop(void) {
+  if (watch.inotify_fd >= 0) close(watch.inotify_fd);
+  watch.inotify_fd = -1;
+  watch.active = false;
+}
+
+static void watch_release(void) {
+  watch_stop();
+  if (watch.owns_adventure) watch_free_adventure();
+  free(watch.path);
+  watch.path = NULL;
+  watch.name = NULL;
+}
+
+// Finds the rooms section of a file that already parsed
+static void watch_find_rooms_section(const char *data, size_t size) {
+  String_View view = sv_from_parts(data, size);
+  bool in_rooms = false;
+  String_View previous = {0};
+  while (view.count > 0) {
+    String_View line = sv_chop_by_newline(&view);
+    if (!in_rooms && sv_eq(line, SV("rooms")) && sv_eq(previous, SV("pam"))) {
+      in_rooms = true;
+      watch.rooms_begin = (size_t)(view.data - data);
+    } else if (in_rooms && sv_eq(line, SV("smoor"))) {
+      watch.rooms_end = (size_t)(line.data - data);
+      return;
+    }
+    previous = line;
+  }
+}
+
+static void watch_reserve_rooms(size_t count) {
+  if (count <= watch.rooms_capacity) return;
+  size_t capacity = watch.rooms_capacity ? watch.rooms_capacity : 64;
+  while (capacity < count) capacity *= 2;
+  watch.starts = realloc(watch.starts, capacity * sizeof(*watch.starts));
+  watch.ends = realloc(watch.ends, capacity * sizeof(*watch.ends));
+  assert(watch.starts != NULL && watch.ends != NULL && "Buy more RAM lol");
+  memset(watch.starts + watch.rooms_capacity, 0, (capacity - watch.rooms_capacity) * sizeof(*watch.starts));
+  memset(watch.ends + watch.rooms_capacity, 0, (capacity - watch.rooms_capacity) * sizeof(*watch.ends));
+  watch.rooms_capacity = capacity;
+  watch.adventure.edge_offsets = watch.starts;
+  watch.adventure.edge_ends = watch.ends;
+}
+
+static void watch_reserve_edges(size_t count) {
+  if (count <= watch.edges_capacity) return;
+  size_t capacity = watch.edges_capacity ? watch.edges_capacity : 64;
+  while (capacity < count) capacity *= 2;
+  watch.edges = realloc(watch.edges, capacity * sizeof(*watch.edges));
+  assert(watch.edges != NULL && "Buy more RAM lol");
+  watch.edges_capacity = capacity;
+  watch.adventure.edges = watch.edges;
+}
+
+// Moves the freshly parsed watch.adventure over to writable exit arrays
+static void watch_take_edges(void) {
+  adventure_t *adv = &watch.adventure;
+  size_t rooms = room_count(adv);
+  const uint32_t *offsets = adv->edge_offsets;
+  const edge_t *edges = adv->edges;
+
+  watch_reserve_rooms(rooms);
+  watch_reserve_edges(adv->edge_count);
+  for (size_t i = 0; i < rooms; ++i) {
+    watch.starts[i] = offsets[i];
+    watch.ends[i] = offsets[i + 1];
+  }
+  memcpy(watch.edges, edges, adv->edge_count * sizeof(*edges));
+  adv->edge_offsets = watch.starts;
+  adv->edge_ends = watch.ends;
+  adv->edges = watch.edges;
+}
+
+// Keeps the session in the room of the same name, or sends it back to the start
+static uint32_t watch_carry_room(const adventure_t *from, uint32_t room, const adventure_t *to) {
+  if (room == NO_ROOM || room >= room_count(from)) return to->start_room;
+  uint32_t carried = find_room(to, from->names.items[room]);
+  if (carried == NO_ROOM || to->descriptions.items[carried].data == NULL) return to->start_room;
+  return carried;
+}
+
+// Parses `path` from scratch into watch.adventure
+static bool watch_full_reload(session_t *session) {
+  adventure_t fresh;
+  if (!read_adventure_source(watch.path, &fresh, false)) return false;
+
+  uint32_t room = session->adventure_loaded && adventure != NULL
+    ? watch_carry_room(adventure, session->current_room, &fresh)
+    : fresh.start_room;
+  if (watch.owns_adventure) watch_free_adventure();
+  watch.adventure = fresh;
+  watch.owns_adventure = true;
+  watch_patch_snapshot(fresh.source.data, 0, 0, fresh.source.size);
+  watch_find_rooms_section(watch.snapshot, watch.snapshot_size);
+  watch_take_edges();
+
+  adventure = &watch.adventure;
+  session->adventure_loaded = true;
+  session->current_room = room;
+  return true;
+}
+
+// Bytes that are the same at the start of both buffers
+static size_t common_prefix(const char *a, const char *b, size_t count) {
+  size_t i = 0;
+  while (i + 4096 <= count && memcmp(a + i, b + i, 4096) == 0) i += 4096;
+  while (i < count && a[i] == b[i]) i++;
+  return i;
+}
+
+// Bytes that are the same at the end of both buffers
+static size_t common_suffix(const char *a, size_t a_size, const char *b, size_t b_size, size_t limit) {
+  size_t i = 0;
+  while (i + 4096 <= limit && memcmp(a + a_size - i - 4096, b + b_size - i - 4096, 4096) == 0) i += 4096;
+  while (i < limit && a[a_size - i - 1] == b[b_size - i - 1]) i++;
+  return i;
+}
+
+typedef struct {
+  uint32_t room;
+  String_View description;
+  size_t first_edge, edge_count;
+} watch_definition_t;
+
+// Re-parses the room lines in [begin, old_end) of the snapshot, which became
+// [begin, new_end) in `data`. Nothing changes unless every new line parses.
+static bool watch_patch_rooms(session_t *session, const char *data, size_t begin, size_t old_end, size_t new_end, size_t *line_count) {
+  adventure_t *adv = &watch.adventure;
+  bool result = true;
+  parsed_edges_t parsed = {0};
+  struct {
+    watch_definition_t *items;
+    size_t count;
+    size_t capacity;
+  } defined = {0};
+  struct {
+    uint32_t *items;
+    size_t count;
+    size_t capacity;
+  } removed = {0};
+
+  // Interning adds rooms and directions for good, so every new line is checked
+  // before the first one touches the adventure
+  *line_count = 0;
+  size_t size = new_end - begin;
+  String_View new_lines = sv_from_parts(data + begin, size);
+  while (new_lines.count > 0) {
+    String_View line = sv_chop_by_newline(&new_lines);
+    // An empty line would end the rooms section early
+    if (line.count == 0) return_defer(false);
+    if (line.data[0] == '#') continue;
+    uint32_t unused;
+    String_View description;
+    if (!parse_room_line(NULL, line, 0, &unused, &description, NULL)) return_defer(false);
+    (*line_count)++;
+  }
+
+  // The new lines outlive this file version, so they are copied
+  char *text = arena_alloc(&adv->arena, size ? size : 1);
+  memcpy(text, data + begin, size);
+
+  String_View old_lines = sv_from_parts(watch.snapshot + begin, old_end - begin);
+  while (old_lines.count > 0) {
+    String_View line = sv_chop_by_newline(&old_lines);
+    if (line.count == 0 || line.data[0] == '#') continue;
+    uint32_t room = find_room(adv, sv_chop_by_byte(&line, '='));
+    if (room != NO_ROOM) da_append(&removed, room);
+  }
+
+  new_lines = sv_from_parts(text, size);
+  while (new_lines.count > 0) {
+    String_View line = sv_chop_by_newline(&new_lines);
+    if (line.data[0] == '#') continue;
+    watch_definition_t definition = { .first_edge = parsed.count };
+    parse_room_line(adv, line, 0, &definition.room, &definition.description, &parsed);
+    definition.edge_count = parsed.count - definition.first_edge;
+    da_append(&defined, definition);
+  }
+
+  watch_reserve_rooms(room_count(adv));
+  for (size_t i = 0; i < removed.count; ++i) {
+    uint32_t room = removed.items[i];
+    adv->descriptions.items[room] = (String_View){0};
+    watch.ends[room] = watch.starts[room];
+  }
+  for (size_t i = 0; i < defined.count; ++i) {
+    const watch_definition_t *definition = &defined.items[i];
+    uint32_t room = definition->room;
+    adv->descriptions.items[room] = definition->description;
+
+    // Reuse the room's slice when the new exits fit, append them otherwise
+    size_t count = definition->edge_count;
+    if (count > watch.ends[room] - watch.starts[room]) {
+      watch_reserve_edges(adv->edge_count + count);
+      watch.starts[room] = (uint32_t)adv->edge_count;
+      adv->edge_count += count;
+    }
+    for (size_t j = 0; j < count; ++j)
+      watch.edges[watch.starts[room] + j] = parsed.items[definition->first_edge + j].edge;
+    watch.ends[room] = watch.starts[room] + (uint32_t)count;
+  }
+
+  adv->content_hash = 0;
+  if (session->current_room >= room_count(adv) || adv->descriptions.items[session->current_room].data == NULL)
+    session->current_room = adv->start_room;
+
+defer:
+  da_free(parsed);
+  da_free(defined);
+  da_free(removed);
+  return result;
+}
+
+// Brings watch.adventure up to date with the file on disk
+static void watch_reload(session_t *session) {
+  uint64_t start = monotonic_nanos();
+  // Only the changed lines are copied out of the new version
+  file_copy_t file;
+  if (!read_file_copy(watch.path, &file)) {
+    // Editors that replace the file may not have written it yet
+    return;
+  }
+
+  size_t old_size = watch.snapshot_size, new_size = file.size;
+  size_t shorter = old_size < new_size ? old_size : new_size;
+  size_t prefix = common_prefix(watch.snapshot, file.data, shorter);
+  if (prefix == old_size && prefix == new_size) {
+    free_file_copy(&file);
+    return;
+  }
+  size_t suffix = common_suffix(watch.snapshot, old_size, file.data, new_size, shorter - prefix);
+
+  // Watch mode works on its own copy, the cached one of the file is out of date now
+  for (adventure_cache_entry_t *entry = adventure_cache.head; entry != NULL; entry = entry->next)
+    if (strcmp(entry->path, watch.path) == 0) entry->stale = true;
+  adventure_cache_trim();
+
+  // Widen the difference to whole lines, the suffix is the same in both
+  size_t begin = prefix, old_end = old_size - suffix, new_end = new_size - suffix;
+  while (begin > 0 && watch.snapshot[begin - 1] != '\n') begin--;
+  while (old_end < old_size && (old_end == 0 || watch.snapshot[old_end - 1] != '\n')) {
+    old_end++;
+    new_end++;
+  }
+
+  size_t line_count;
+  if (begin >= watch.rooms_begin && old_end <= watch.rooms_end &&
+      watch_patch_rooms(session, file.data, begin, old_end, new_end, &line_count)) {
+    watch.rooms_end = watch.rooms_end + new_size - old_size;
+    watch_patch_snapshot(file.data, begin, old_end, new_end);
+    free_file_copy(&file);
+    log_message(temp_sprintf(COLOR_YELLOW"Info: %s changed, re-parsed %zu room line(s) in %.1f us",
+                             watch.path, line_count, (monotonic_nanos() - start) / 1e3));
+    return;
+  }
+  free_file_copy(&file);
+
+  if (watch_full_reload(session))
+    log_message(temp_sprintf(COLOR_YELLOW"Info: %s changed, parsed it again in %.1f ms",
+                             watch.path, (monotonic_nanos() - start) / 1e6));
+  else
+    log_message(COLOR_RED"Error: the changed adventure is kept as it was");
+}
+
+// Reloads when the watched file was written, never blocks
+static void watch_poll(session_t *session) {
+  if (!watch.active) return;
+  char buf[WATCH_EVENT_BUF_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool changed = false;
+  for (;;) {
+    ssize_t n = read(watch.inotify_fd, buf, sizeof(buf));
+    if (n <= 0) break;
+    for (char *p = buf; p < buf + n;) {
+      const struct inotify_event *event = (const struct inotify_event *)p;
+      if (event->len > 0 && strcmp(event->name, watch.name) == 0) changed = true;
+      p += sizeof(*event) + event->len;
+    }
+  }
+  if (changed) watch_reload(session);
+}
+
+// Waits for input on stdin while watching, false when the screen has to be
+// redrawn first because of a reload or a signal
+static bool watch_wait_for_input(session_t *session) {
+#ifdef __GLIBC__
+  // Lines stdio already buffered would not wake poll() up
+  if (stdin->_IO_read_ptr < stdin->_IO_read_end) return true;
+#endif //__GLIBC__
+  struct pollfd fds[2] = {
+    { .fd = STDIN_FILENO, .events = POLLIN },
+    { .fd = watch.inotify_fd, .events = POLLIN },
+  };
+  if (poll(fds, 2, -1) < 0) return false;
+  if (fds[1].revents & POLLIN) {
+    watch_poll(session);
+    return false;
+  }
+  return true;
+}
+
+static bool watch_start(session_t *session, const char *path) {
+  watch_stop();
+  char *previous = watch.path;
+  watch.path = strdup(path);
+  if (!watch_full_reload(session)) {
+    free(watch.path);
+    watch.path = previous;
+    return false;
+  }
+  free(previous);
+  const char *slash = strrchr(watch.path, '/');
+  watch.name = slash ? slash + 1 : watch.path;
+
+  const char *dir = slash ? temp_sprintf("%.*s", (int)(slash - watch.path), watch.path) : ".";
+  if (*dir == '\0') dir = "/";
+  watch.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watch.inotify_fd < 0 || inotify_add_watch(watch.inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    log_message(temp_sprintf(COLOR_RED"Error: could not watch %s: %s", dir, strerror(errno)));
+    watch_stop();
+    return false;
+  }
+  watch.active = true;
+  return true;
+}
+#endif //__linux__
+
+// Saved games hold a header, the log records oldest first and then their
+// text. A snapshot is built in one static buffer and written with a single
+// write, restoring is a single read into the same buffer, so neither side
+// allocates. The adventure itself is identified by its content hash and has
+// to be loaded before restoring, the current room by room_name_hash().
+#define SAVE_MAGIC "TAS\x1a"
+#define SAVE_VERSION 2
+#define SAVE_EXTENSION ".tas"
+#define SAVE_FLAG_ADVENTURE_LOADED 1u
+#define SAVE_MAX_SERVER_NAME 64
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t adventure_hash;
+  // hash_bytes() of everything after the header, catches torn writes
+  uint64_t checksum;
+  uint64_t room_hash;
+  uint32_t flags;
+  uint32_t message_count;
+  uint32_t text_size;
+} save_header_t;
+
+typedef struct {
+  int64_t time;
+  uint32_t length;
+  uint32_t reserved;
+} save_message_t;
+
+#define SAVE_BUF_CAP (sizeof(save_header_t) + MESSAGE_LOG_CAPACITY * sizeof(save_message_t) + MESSAGE_LOG_TEXT_CAPACITY)
+#define SAVE_CHECKSUM_SEED 0x7461652d73617665ull
+
+// One byte more than the largest snapshot so oversized files are noticed
+static char save_buf[SAVE_BUF_CAP + 1];
+
+// Set by run_server() when clients may save, their snapshots live there
+static const char *server_snapshot_dir = NULL;
+
+// Encodes `session` and the log into save_buf, returns the size. Server
+// sessions have no log, their output goes straight to the client.
+static size_t save_encode(const session_t *session, bool with_log) {
+  save_header_t header = {
+    .version = SAVE_VERSION,
+    .message_count = with_log ? (uint32_t)message_log.count : 0,
+  };
+  memcpy(header.magic, SAVE_MAGIC, sizeof(header.magic));
+  if (session->adventure_loaded) {
+    header.flags |= SAVE_FLAG_ADVENTURE_LOADED;
+    header.adventure_hash = adventure_content_hash(adventure);
+    header.room_hash = room_name_hash(adventure, session->current_room);
+  }
+
+  char *records = save_buf + sizeof(header);
+  char *text = records + header.message_count * sizeof(save_message_t);
+  for (size_t i = 0; i < header.message_count; ++i) {
+    const message_t *message = message_log_at(i);
+    save_message_t record = { .time = (int64_t)message->time, .length = message->length };
+    memcpy(records + i * sizeof(record), &record, sizeof(record));
+    memcpy(text + header.text_size, message_text(message).data, message->length);
+    header.text_size += message->length;
+  }
+
+  size_t size = (size_t)(text - save_buf) + header.text_size;
+  header.checksum = hash_bytes(SAVE_CHECKSUM_SEED, save_buf + sizeof(header), size - sizeof(header));
+  memcpy(save_buf, &header, sizeof(header));
+  return size;
+}
+
+// Writes a temporary file and renames it over `path`, a crash leaves either the
+// old save or the new one. Only a `durable` save waits for the disk, the
+// server must not stall every session on one client's flush.
+static bool write_save_file(const char *path, const char *data, size_t size, bool durable) {
+  const char *temp = temp_sprintf("%s.tmp", path);
+#ifdef _WIN32
+  int fd = _open(temp, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+  if (fd < 0) return false;
+  bool ok = _write(fd, data, (unsigned)size) == (int)size && (!durable || _commit(fd) == 0);
+  ok = _close(fd) == 0 && ok;
+#else
+  int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return false;
+  bool ok = write(fd, data, size) == (ssize_t)size && (!durable || fsync(fd) == 0);
+  ok = close(fd) == 0 && ok;
+#endif //_WIN32
+  if (ok && replace_file(temp, path)) return true;
+  int saved = errno;
+  remove(temp);
+  errno = saved;
+  return false;
+}
+
+// Reads the whole file into save_buf, returns the size or -1
+static long long read_save_file(const char *path) {
+#ifdef _WIN32
+  int fd = _open(path, _O_RDONLY | _O_BINARY);
+  if (fd < 0) return -1;
+  long long size = _read(fd, save_buf, sizeof(save_buf));
+  _close(fd);
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return -1;
+  long long size = read(fd, save_buf, sizeof(save_buf));
+  close(fd);
+#endif //_WIN32
+  return size;
+}
+
+// NULL when a server client asks for anything but a plain name, those can
+// only reach files in the server's snapshot directory
+static const char *save_path(String_View name) {
+  if (server_snapshot_dir != NULL) {
+    if (name.count > SAVE_MAX_SERVER_NAME) return NULL;
+    for (size_t i = 0; i < name.count; ++i)
+      if (!isalnum((unsigned char)name.data[i]) && name.data[i] != '-' && name.data[i] != '_') return NULL;
+    return temp_sprintf("%s/"SV_Fmt SAVE_EXTENSION, server_snapshot_dir, SV_Arg(name));
+  }
+  if (sv_end_with(name, SAVE_EXTENSION)) return temp_sv_to_cstr(name);
+  return temp_sprintf(SV_Fmt SAVE_EXTENSION, SV_Arg(name));
+}
+
+static void command_save(session_t *session, String_View args) {
+  if (sv_eq(args, SV(""))) {
+    log_message(COLOR_RED"Error: no save name provided, please provide a name");
+    return;
+  }
+  if (adventure_read_only && server_snapshot_dir == NULL) {
+    log_message(COLOR_RED"Error: saving is disabled on this server");
+    return;
+  }
+
+  const char *path = save_path(args);
+  if (path == NULL) {
+    log_message(COLOR_RED"Error: save names on this server may only use letters, digits, '-' and '_'");
+    return;
+  }
+  size_t size = save_encode(session, server_snapshot_dir == NULL);
+  if (!write_save_file(path, save_buf, size, !adventure_read_only)) {
+    log_message(temp_sprintf(COLOR_RED"Error: could not write save file %s: %s", path, strerror(errno)));
+    return;
+  }
+  log_message(temp_sprintf(COLOR_YELLOW"Info: saved to %s (%zu bytes)", path, size));
+}
+
+static void command_restore(session_t *session, String_View args) {
+  if (sv_eq(args, SV(""))) {
+    log_message(COLOR_RED"Error: no save name provided, please provide a name");
+    return;
+  }
+  if (adventure_read_only && server_snapshot_dir == NULL) {
+    log_message(COLOR_RED"Error: restoring is disabled on this server");
+    return;
+  }
+
+  const char *path = save_path(args);
+  if (path == NULL) {
+    log_message(COLOR_RED"Error: save names on this server may only use letters, digits, '-' and '_'");
+    return;
+  }
+  long long size = read_save_file(path);
+  if (size < 0) {
+    log_message(temp_sprintf(COLOR_RED"Error: could not read save file %s: %s", path, strerror(errno)));
+    return;
+  }
+
+  // Everything is checked before the session or the log is touched
+  save_header_t header;
+  if ((size_t)size < sizeof(header)) goto invalid;
+  memcpy(&header, save_buf, sizeof(header));
+  if (memcmp(header.magic, SAVE_MAGIC, sizeof(header.magic)) != 0) goto invalid;
+  if (header.version != SAVE_VERSION) {
+    log_message(temp_sprintf(COLOR_RED"Error: %s is a version %u save, this build reads version %u",
+                             path, header.version, SAVE_VERSION));
+    return;
+  }
+  if (header.message_count > MESSAGE_LOG_CAPACITY || header.text_size > MESSAGE_LOG_TEXT_CAPACITY) goto invalid;
+  const char *records = save_buf + sizeof(header);
+  const char *text = records + header.message_count * sizeof(save_message_t);
+  if ((size_t)size != (size_t)(text - save_buf) + header.text_size) goto invalid;
+  if (hash_bytes(SAVE_CHECKSUM_SEED, records, (size_t)size - sizeof(header)) != header.checksum) goto invalid;
+  uint64_t text_size = 0;
+  for (uint32_t i = 0; i < header.message_count; ++i) {
+    save_message_t record;
+    memcpy(&record, records + i * sizeof(record), sizeof(record));
+    text_size += record.length;
+  }
+  if (text_size != header.text_size) goto invalid;
+
+  bool loaded = (header.flags & SAVE_FLAG_ADVENTURE_LOADED) != 0;
+  uint32_t room = NO_ROOM;
+  if (loaded) {
+    if (!session->adventure_loaded || adventure_content_hash(adventure) != header.adventure_hash) {
+      log_message(temp_sprintf(COLOR_RED"Error: %s belongs to a different adventure, please load that one first", path));
+      return;
+    }
+    room = find_room_by_name_hash(adventure, header.room_hash);
+    if (room == NO_ROOM) goto invalid;
+  }
+
+  // Server sessions always play the hosted adventure and never have a log
+  if (server_snapshot_dir != NULL && !loaded) goto invalid;
+  if (server_snapshot_dir == NULL) {
+    log_clear();
+    size_t offset = 0;
+    for (uint32_t i = 0; i < header.message_count; ++i) {
+      save_message_t record;
+      memcpy(&record, records + i * sizeof(record), sizeof(record));
+      message_log_append(text + offset, record.length, (time_t)record.time);
+      offset += record.length;
+    }
+  }
+  session->adventure_loaded = loaded;
+  session->current_room = room;
+  log_message(temp_sprintf(COLOR_YELLOW"Info: restored %s", path));
+  if (loaded)
+    log_message(temp_sprintf(COLOR_YELLOW SV_Fmt, SV_Arg(room_description(adventure, session->current_room))));
+  return;
+
+invalid:
+  log_message(temp_sprintf(COLOR_RED"Error: invalid or corrupt save file: %s", path));
+}
+
+static void command_exit(session_t *session, String_View args) {
+  (void)args;
+  session->exit_requested = true;
+}
+
+static void command_help(session_t *session, String_View args) {
+  (void)session;
+  (void)args;
+  log_help();
+}
+
+static void command_clear(session_t *session, String_View args) {
+  (void)session;
+  (void)args;
+  log_clear();
+}
+
+// How many rooms share their description with another, for the load message
+static const char *describe_dedup(const adventure_t *loaded) {
+  if (loaded->lazy.unparsed > 0)
+    return temp_sprintf("%zu rooms indexed, parsed when first needed", loaded->lazy.unparsed);
+  size_t defined = 0;
+  for (size_t i = 0; i < room_count(loaded); ++i)
+    if (loaded->descriptions.items[i].data != NULL) defined++;
+  size_t unique = loaded->unique_descriptions;
+  // Only a load that interned its descriptions knows how many are unique
+  if (unique == 0 && defined > 0) return temp_sprintf("%zu descriptions, dedup ratio not computed", defined);
+  return temp_sprintf("%zu descriptions, %zu unique, dedup ratio %.2fx",
+                      defined, unique, unique > 0 ? (double)defined / unique : 1.0);
+}
+
+static void command_load(session_t *session, String_View args) {
+  if (sv_eq(args, SV(""))) {
+    log_message(COLOR_RED"Error: no adventure name provided, please provide a name");
+    return;
+  }
+
+  if (adventure_read_only) {
+    log_message(COLOR_RED"Error: this server only hosts its own adventure");
+    return;
+  }
+
+  const char *filename;
+  bool cached;
+  adventure_t *loaded = load_adventure(args, &filename, &cached);
+  session->adventure_loaded = loaded != NULL;
+  if (loaded == NULL) return;
+
+  adventure = loaded;
+#ifdef __linux__
+  watch_release();
+#endif //__linux__
+  adventure_cache_trim();
+  session->current_room = adventure->start_room;
+  if (cached)
+    log_message(temp_sprintf(COLOR_YELLOW"Info: adventure \"%s\" loaded from the cache", filename));
+  else
+    log_message(temp_sprintf(COLOR_YELLOW"Info: adventure \"%s\" loaded successfully (arena high-water mark %zu KiB of %zu KiB reserved, %s)",
+                             filename, adventure->arena.used / 1024, adventure->arena.reserved / 1024,
+                             describe_dedup(adventure)));
+  log_message(temp_sprintf(COLOR_YELLOW SV_Fmt, SV_Arg(room_description(adventure, session->current_room))));
+}
+
+static void command_cache(session_t *session, String_View args) {
+  (void)session;
+  String_View subcommand = sv_chop_by_predicate(&args, isspace);
+  if (sv_eq(subcommand, SV("budget"))) {
+    // The budget is shared by every session, no single client gets to change it
+    if (adventure_read_only) {
+      log_message(COLOR_RED"Error: the cache budget can not be changed on this server");
+      return;
+    }
+    char *end;
+    const char *value = temp_sv_to_cstr(sv_trim(args));
+    unsigned long long mib = strtoull(value, &end, 10);
+    if (*value == '\0' || *end != '\0') {
+      log_message(COLOR_RED"Error: usage is \"cache budget <MiB>\"");
+      return;
+    }
+    adventure_cache.budget = (size_t)mib * 1024 * 1024;
+    adventure_cache_trim();
+  } else if (!sv_eq(subcommand, SV(""))) {
+    log_message(COLOR_RED"Error: usage is \"cache\" or \"cache budget <MiB>\"");
+    return;
+  }
+
+  log_message(temp_sprintf(COLOR_YELLOW"Info: %zu adventures cached, %zu KiB of %zu KiB budget, %llu hits, %llu misses, %llu evictions",
+                           adventure_cache.count, adventure_cache.bytes / 1024, adventure_cache.budget / 1024,
+                           (unsigned long long)adventure_cache.hits, (unsigned long long)adventure_cache.misses,
+                           (unsigned long long)adventure_cache.evictions));
+}
+
+static void command_look(session_t *session, String_View args) {
+  if (!session->adventure_loaded) {
+    log_message(COLOR_RED"Error: no adventure loaded, please use the \"load\" command first");
+    return;
+  }
+
+  String_View direction = sv_chop_by_predicate(&args, isspace);
+  if (sv_eq(direction, SV(""))) {
+    log_message(temp_sprintf(COLOR_YELLOW SV_Fmt, SV_Arg(room_description(adventure, session->current_room))));
+    return;
+  }
+
+  uint32_t idx = find_direction(adventure, direction);
+  // A lazy adventure only knows the directions of the rooms parsed so far
+  if (idx == NO_DIRECTION && adventure->lazy.unparsed > 0) {
+    adventure_parse_all(adventure);
+    idx = find_direction(adventure, direction);
+  }
+  if (idx == NO_DIRECTION) {
+    log_message(temp_sprintf(COLOR_RED"Error: \""SV_Fmt"\" is an invalid direction", SV_Arg(direction)));
+    return;
+  }
+
+  uint32_t next = room_exit(adventure, session->current_room, idx);
+  if (next == NO_ROOM) {
+    log_message(temp_sprintf(COLOR_YELLOW"There is no exit "SV_Fmt" from here", SV_Arg(direction)));
+    return;
+  }
+  // Only --check refuses exits to rooms that are never defined
+  String_View description = room_description(adventure, next);
+  if (description.data == NULL)
+    log_message(temp_sprintf(COLOR_YELLOW"The exit "SV_Fmt" from here leads nowhere", SV_Arg(direction)));
+  else
+    log_message(temp_sprintf(COLOR_YELLOW SV_Fmt, SV_Arg(description)));
+}
+
+#ifdef TAE_STATS
+static const char *format_nanos(uint64_t nanos) {
+  if (nanos < 1000) return temp_sprintf("%lluns", (unsigned long long)nanos);
+  if (nanos < 1000000) return temp_sprintf("%.1fus", nanos / 1e3);
+  if (nanos < 1000000000) return temp_sprintf("%.1fms", nanos / 1e6);
+  return temp_sprintf("%.2fs", nanos / 1e9);
+}
+#endif // TAE_STATS
+
+static void command_stats(session_t *session, String_View args) {
+  (void)session;
+  (void)args;
+  if (screen.frames > 0)
+    log_message(temp_sprintf(COLOR_YELLOW"frames n=%zu last=%zu bytes in %zu write(s) avg=%.1f bytes in %.2f write(s)",
+                             screen.frames, screen.frame_bytes, screen.frame_syscalls,
+                             (double)screen.total_bytes / screen.frames, (double)screen.total_syscalls / screen.frames));
+#ifdef TAE_STATS
+  for (size_t i = 0; i < latency_histograms.count; ++i) {
+    const latency_histogram_t *histogram = &latency_histograms.items[i];
+    if (histogram->count == 0) continue;
+    log_message(temp_sprintf(COLOR_YELLOW"%-6s n=%llu p50=%s p90=%s p99=%s max=%s", histogram->name,
+                             (unsigned long long)histogram->count,
+                             format_nanos(latency_percentile(histogram, 50.0)),
+                             format_nanos(latency_percentile(histogram, 90.0)),
+                             format_nanos(latency_percentile(histogram, 99.0)),
+                             format_nanos(histogram->max)));
+  }
+#else
+  log_message(COLOR_RED"Error: this build has no statistics, rebuild with -DTAE_STATS");
+#endif // TAE_STATS
+}
+
+static void command_watch(session_t *session, String_View args) {
+#ifdef __linux__
+  if (adventure_read_only) {
+    log_message(COLOR_RED"Error: this server only hosts its own adventure");
+    return;
+  }
+
+  if (sv_eq(args, SV("off"))) {
+    if (watch.active) log_message(temp_sprintf(COLOR_YELLOW"Info: stopped watching %s", watch.path));
+    watch_stop();
+    return;
+  }
+  if (!sv_eq(args, SV(""))) {
+    log_message(COLOR_RED"Error: usage is \"watch\" or \"watch off\"");
+    return;
+  }
+  if (!session->adventure_loaded) {
+    log_message(COLOR_RED"Error: no adventure loaded, please use the \"load\" command first");
+    return;
+  }
+  if (watch.active) {
+    log_message(temp_sprintf(COLOR_YELLOW"Info: already watching %s", watch.path));
+    return;
+  }
+
+  const char *path = adventure == &watch.adventure ? watch.path : adventure_cache_path(adventure);
+  if (path == NULL) return;
+  // Authors edit the source, so a compiled adventure is watched through its .ta
+  if (sv_end_with(SV(path), ".tac")) path = temp_sprintf("%.*s", (int)strlen(path) - 1, path);
+  if (!watch_start(session, path)) return;
+  log_message(temp_sprintf(COLOR_YELLOW"Info: watching %s, changed rooms are reloaded as you save", watch.path));
+#else
+  (void)session;
+  (void)args;
+  log_message(COLOR_RED"Error: watch mode needs inotify, it is only available on Linux");
+#endif //__linux__
+}
+
+static void register_builtin_commands(void) {
+  bool ok = true;
+  ok &= register_command("exit", command_exit);
+  ok &= register_command("quit", command_exit);
+  ok &= register_command("help", command_help);
+  ok &= register_command("?", command_help);
+  ok &= register_command("clear", command_clear);
+  ok &= register_command("load", command_load);
+  ok &= register_command("look", command_look);
+  ok &= register_command("l", command_look);
+  ok &= register_command("stats", command_stats);
+  ok &= register_command("cache", command_cache);
+  ok &= register_command("watch", command_watch);
+  ok &= register_command("save", command_save);
+  ok &= register_command("restore", command_restore);
+  assert(ok && "builtin commands must register");
+}
+
+// `line` must already be lowercased, returns false for unknown verbs
+static bool dispatch_command(session_t *session, String_View line) {
+  String_View verb = sv_chop_by_predicate(&line, isspace);
+  const command_t *command = find_command(verb);
+  if (command == NULL) {
+    log_message(COLOR_RED"Error: unknown command");
+    return false;
+  }
+
+  STATS_BEGIN(start);
+  command->handler(session, line);
+  STATS_END(command->histogram, start);
+  return true;
+}
+
+// The command journal, enabled with --journal, gets one record per accepted
+// command: a fixed header followed by the lowercased line. Each record carries
+// the adventure's content hash before the command and a hash of the session
+// after it, so a replay can tell exactly where it went a different way. The
+// file is append only, every record goes out in a single write.
+#define JOURNAL_MAGIC "TAJ\x1a"
+#define JOURNAL_VERSION 2
+// Set on the first record of every run, a replay starts a fresh session there
+#define JOURNAL_FLAG_SESSION_START 1u
+#define JOURNAL_MAX_REPORTED_DIVERGENCES 16
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+} journal_header_t;
+
+typedef struct {
+  // Wall clock time the command was accepted at
+  int64_t time_ns;
+  uint64_t duration_ns;
+  // 0 while no adventure is loaded
+  uint64_t adventure_hash;
+  uint64_t result_hash;
+  // room_name_hash() of the room the command ended in, 0 without an adventure
+  uint64_t result_room;
+  uint32_t flags;
+  uint32_t length;
+} journal_record_t;
+
+static struct {
+  FILE *file;
+  bool session_started;
+} journal = {};
+
+static uint64_t session_hash(const session_t *session) {
+  uint64_t hash = hash_mix(0, session->adventure_loaded);
+  if (!session->adventure_loaded) return hash;
+  return hash_mix(hash_mix(hash, adventure_content_hash(adventure)), room_name_hash(adventure, session->current_room));
+}
+
+static bool journal_open(const char *path) {
+  journal_header_t header;
+  FILE *existing = fopen(path, "rb");
+  if (existing != NULL) {
+    size_t count = fread(&header, 1, sizeof(header), existing);
+    fclose(existing);
+    if (count > 0 && (count != sizeof(header) || memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+                      header.version != JOURNAL_VERSION)) {
+      fprintf(stderr, "Error: %s is not a version %u command journal\n", path, JOURNAL_VERSION);
+      return false;
+    }
+  }
+
+  journal.file = fopen(path, "ab");
+  if (journal.file == NULL) {
+    fprintf(stderr, "Error: could not open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  if (ftell(journal.file) == 0) {
+    header = (journal_header_t){ .version = JOURNAL_VERSION };
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    fwrite(&header, sizeof(header), 1, journal.file);
+  }
+  return true;
+}
+
+static void journal_append(journal_record_t *record, const char *line) {
+  char buf[sizeof(journal_record_t) + INPUT_BUF_CAP];
+  if (!journal.session_started) {
+    record->flags |= JOURNAL_FLAG_SESSION_START;
+    journal.session_started = true;
+  }
+  memcpy(buf, record, sizeof(*record));
+  memcpy(buf + sizeof(*record), line, record->length);
+  // One fwrite plus the flush is one write() of the whole record
+  if (fwrite(buf, 1, sizeof(*record) + record->length, journal.file) != sizeof(*record) + record->length ||
+      fflush(journal.file) != 0) {
+    log_message(temp_sprintf(COLOR_RED"Error: could not write the command journal: %s, it is closed now", strerror(errno)));
+    fclose(journal.file);
+    journal.file = NULL;
+  }
+}
+
+static void journal_close(void) {
+  if (journal.file == NULL) return;
+  fclose(journal.file);
+  journal.file = NULL;
+}
+
+// Lowercases and dispatches one line of input, a trailing newline is dropped
+static void run_input_line(session_t *session, char *line, bool echo) {
+  size_t length = strlen(line);
+  while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+    line[--length] = '\0';
+  if (length == 0) return;
+
+  if (echo) log_message(line);
+  for (size_t i = 0; i < length; ++i)
+    line[i] = tolower(line[i]);
+  if (journal.file == NULL) {
+    dispatch_command(session, sv_from_parts(line, length));
+    return;
+  }
+
+  journal_record_t record = {
+    .time_ns = realtime_nanos(),
+    .adventure_hash = session->adventure_loaded ? adventure_content_hash(adventure) : 0,
+    .length = (uint32_t)length,
+  };
+  uint64_t start = monotonic_nanos();
+  if (!dispatch_command(session, sv_from_parts(line, length))) return;
+  record.duration_ns = monotonic_nanos() - start;
+  record.result_hash = session_hash(session);
+  record.result_room = session->adventure_loaded ? room_name_hash(adventure, session->current_room) : 0;
+  journal_append(&record, line);
+}
+
+// Runs commands from `stream` without touching the terminal, responses go to
+// stdout as plain lines
+static int run_batch(FILE *stream) {
+  static char stdout_buf[64*1024];
+  setvbuf(stdout, stdout_buf, _IOFBF, sizeof(stdout_buf));
+  String_Builder responses = {0};
+  log_redirect = &responses;
+
+  register_builtin_commands();
+  session_t session = { .current_room = NO_ROOM };
+
+  while (!session.exit_requested && fgets(input_buf, INPUT_BUF_CAP, stream) != NULL) {
+    size_t length = strlen(input_buf);
+    // Drop the rest of a line too long for the input buffer
+    if (length > 0 && input_buf[length - 1] != '\n')
+      for (int c = fgetc(stream); c != EOF && c != '\n'; c = fgetc(stream));
+
+    size_t save = temp_save();
+#ifdef __linux__
+    watch_poll(&session);
+#endif //__linux__
+    run_input_line(&session, input_buf, false);
+    temp_rewind(save);
+    fwrite(responses.items, 1, responses.count, stdout);
+    responses.count = 0;
+  }
+
+  log_redirect = NULL;
+  sb_free(responses);
+  fflush(stdout);
+  return ferror(stream) ? 1 : 0;
+}
+
+// Commands whose effects reach past the session: files on disk, the watched
+// file or limits shared with other sessions. A replay must not run them again.
+static bool replay_skips(String_View line) {
+  String_View verb = sv_chop_by_predicate(&line, isspace);
+  if (sv_eq(verb, SV("cache"))) return sv_eq(sv_chop_by_predicate(&line, isspace), SV("budget"));
+  return sv_eq(verb, SV("save")) || sv_eq(verb, SV("restore")) || sv_eq(verb, SV("watch"));
+}
+
+// Re-executes a command journal against the adventures on disk with output
+// discarded, then reports the time taken and every record whose state did
+// not match the recording. Commands replay_skips() are not run, the session
+// takes over the room they ended in instead.
+static int run_replay(const char *path) {
+  file_copy_t file;
+  if (!read_file_copy(path, &file)) {
+    fprintf(stderr, "Error: could not read journal %s\n", path);
+    return 1;
+  }
+
+  journal_header_t header;
+  if (file.size < sizeof(header)) memset(&header, 0, sizeof(header));
+  else memcpy(&header, file.data, sizeof(header));
+  if (memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 || header.version != JOURNAL_VERSION) {
+    fprintf(stderr, "Error: %s is not a version %u command journal\n", path, JOURNAL_VERSION);
+    free_file_copy(&file);
+    return 1;
+  }
+
+  String_Builder responses = {0};
+  log_redirect = &responses;
+  register_builtin_commands();
+
+  session_t session = { .current_room = NO_ROOM };
+  char line[INPUT_BUF_CAP];
+  size_t offset = sizeof(header), count = 0, divergences = 0, skipped = 0;
+  uint64_t recorded_nanos = 0, command_nanos = 0;
+  uint64_t start = monotonic_nanos();
+  while (offset < file.size) {
+    journal_record_t record;
+    if (file.size - offset < sizeof(record)) break;
+    memcpy(&record, file.data + offset, sizeof(record));
+    if (record.length >= INPUT_BUF_CAP || file.size - offset - sizeof(record) < record.length) break;
+    memcpy(line, file.data + offset + sizeof(record), record.length);
+    offset += sizeof(record) + record.length;
+
+    size_t save = temp_save();
+    if (record.flags & JOURNAL_FLAG_SESSION_START) session = (session_t){ .current_room = NO_ROOM };
+    if (replay_skips(sv_from_parts(line, record.length))) {
+      count++;
+      if (skipped++ < JOURNAL_MAX_REPORTED_DIVERGENCES)
+        printf("Skipped command %zu \"%.*s\": it is not replayed, the recorded room is taken over\n",
+               count, (int)record.length, line);
+      uint32_t room = session.adventure_loaded ? find_room_by_name_hash(adventure, record.result_room) : NO_ROOM;
+      if (room != NO_ROOM) session.current_room = room;
+      temp_rewind(save);
+      continue;
+    }
+    uint64_t adventure_hash = session.adventure_loaded ? adventure_content_hash(adventure) : 0;
+    uint64_t command_start = monotonic_nanos();
+    bool accepted = dispatch_command(&session, sv_from_parts(line, record.length));
+    command_nanos += monotonic_nanos() - command_start;
+    recorded_nanos += record.duration_ns;
+    count++;
+
+    const char *reason = NULL;
+    uint64_t room = session.adventure_loaded ? room_name_hash(adventure, session.current_room) : 0;
+    if (adventure_hash != record.adventure_hash) reason = "the adventure is not the recorded one";
+    else if (!accepted) reason = "the command was not accepted";
+    else if (room != record.result_room) {
+      reason = session.adventure_loaded
+        ? temp_sprintf("ended in room \""SV_Fmt"\" instead of the recorded one", SV_Arg(adventure->names.items[session.current_room]))
+        : "ended without an adventure";
+    }
+    else if (session_hash(&session) != record.result_hash) reason = "ended in a different state";
+    if (reason != NULL && divergences++ < JOURNAL_MAX_REPORTED_DIVERGENCES)
+      printf("Divergence at command %zu \"%.*s\": %s\n", count, (int)record.length, line, reason);
+
+    responses.count = 0;
+    temp_rewind(save);
+  }
+  uint64_t elapsed = monotonic_nanos() - start;
+
+  if (offset < file.size)
+    printf("Warning: %zu trailing bytes of %s do not form a whole record, ignored\n", file.size - offset, path);
+  printf("Replayed %zu commands in %.3f ms (%.3f ms in commands, %.3f ms when recorded), %zu skipped, %zu divergence(s)\n",
+         count, elapsed / 1e6, command_nanos / 1e6, recorded_nanos / 1e6, skipped, divergences);
+
+  log_redirect = NULL;
+  sb_free(responses);
+  free_file_copy(&file);
+  return divergences > 0 ? 1 : 0;
+}
+
+#ifdef __linux__
+// Server mode: one epoll loop multiplexes every connection. A client is the
+// session plus its pending input line, responses are composed into a shared
+// buffer and sent right away, only what the socket does not take is copied
+// into the client. An idle client costs sizeof(client_t) and nothing else.
+#define SERVER_MAX_EVENTS 256
+#define SERVER_READ_CHUNK (4*1024)
+// A client that lets this much output pile up is disconnected
+#define SERVER_OUTPUT_LIMIT (64*1024)
+
+typedef struct {
+  int fd;
+  session_t session;
+  // Input line under construction, discarding drops the rest of one too long
+  uint16_t input_count;
+  bool discarding;
+  char input[INPUT_BUF_CAP];
+  // Unsent output, NULL while everything went out
+  char *output;
+  uint32_t output_sent, output_count;
+} client_t;
+
+static struct {
+  int epoll_fd;
+  size_t clients;
+  String_Builder responses;
+} server = {};
+
+static void client_close(client_t *client) {
+  close(client->fd);
+  free(client->output);
+  free(client);
+  server.clients--;
+}
+
+static void client_want_write(client_t *client, bool want) {
+  struct epoll_event event = {
+    .events = EPOLLIN | (want ? EPOLLOUT : 0),
+    .data.ptr = client,
+  };
+  epoll_ctl(server.epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+}
+
+// Sends the client's backlog, false when the client is gone
+static bool client_flush(client_t *client) {
+  while (client->output_sent < client->output_count) {
+    ssize_t n = send(client->fd, client->output + client->output_sent,
+                     client->output_count - client->output_sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+      return false;
+    }
+    client->output_sent += (uint32_t)n;
+  }
+  free(client->output);
+  client->output = NULL;
+  client->output_sent = client->output_count = 0;
+  client_want_write(client, false);
+  return true;
+}
+
+// Sends server.responses to the client, false when the client is gone
+static bool client_send_responses(client_t *client) {
+  const char *data = server.responses.items;
+  size_t count = server.responses.count;
+  server.responses.count = 0;
+  if (count == 0) return true;
+
+  if (client->output == NULL) {
+    while (count > 0) {
+      ssize_t n = send(client->fd, data, count, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        return false;
+      }
+      data += n;
+      count -= (size_t)n;
+    }
+    if (count == 0) return true;
+  }
+
+  size_t pending = client->output_count - client->output_sent;
+  if (pending + count > SERVER_OUTPUT_LIMIT) return false;
+  char *output = malloc(pending + count);
+  if (output == NULL) return false;
+  if (pending > 0) memcpy(output, client->output + client->output_sent, pending);
+  memcpy(output + pending, data, count);
+  bool was_waiting = client->output != NULL;
+  free(client->output);
+  client->output = output;
+  client->output_sent = 0;
+  client->output_count = (uint32_t)(pending + count);
+  if (!was_waiting) client_want_write(client, true);
+  return true;
+}
+
+// Runs every complete line in `data`, false when the client is gone
+static bool client_receive(client_t *client, const char *data, size_t count) {
+  log_redirect = &server.responses;
+  for (size_t i = 0; i < count && !client->session.exit_requested; ++i) {
+    char c = data[i];
+    if (c != '\n') {
+      if (client->input_count + 1 < INPUT_BUF_CAP) client->input[client->input_count++] = c;
+      else client->discarding = true;
+      continue;
+    }
+
+    if (!client->discarding) {
+      client->input[client->input_count] = '\0';
+      size_t save = temp_save();
+      run_input_line(&client->session, client->input, false);
+      temp_rewind(save);
+    }
+    client->input_count = 0;
+    client->discarding = false;
+  }
+  log_redirect = NULL;
+
+  if (!client_send_responses(client)) return false;
+  // Quitting clients are let go once their last responses are out
+  return !client->session.exit_requested || client->output != NULL;
+}
+
+static void client_accept(int listen_fd) {
+  for (;;) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        fprintf(stderr, "Error: accept failed: %s\n", strerror(errno));
+      return;
+    }
+
+    client_t *client = malloc(sizeof(*client));
+    if (client == NULL) {
+      close(fd);
+      continue;
+    }
+    *client = (client_t){
+      .fd = fd,
+      .session = { .adventure_loaded = true, .current_room = adventure->start_room },
+    };
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = client };
+    if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+      close(fd);
+      free(client);
+      continue;
+    }
+    server.clients++;
+
+    size_t save = temp_save();
+    log_redirect = &server.responses;
+    log_message(temp_sprintf(COLOR_YELLOW SV_Fmt, SV_Arg(room_description(adventure, adventure->start_room))));
+    log_redirect = NULL;
+    temp_rewind(save);
+    if (!client_send_responses(client)) client_close(client);
+  }
+}
+
+// `address` is a TCP port on the loopback interface or a Unix socket path
+static int server_listen(const char *address) {
+  char *end;
+  unsigned long port = strtoul(address, &end, 10);
+  bool tcp = *address != '\0' && *end == '\0';
+
+  int fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+
+  int result;
+  if (tcp) {
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_port = htons((uint16_t)port),
+      .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    result = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  } else {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(address) >= sizeof(addr.sun_path)) {
+      close(fd);
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+    strcpy(addr.sun_path, address);
+    unlink(address);
+    result = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  }
+
+  if (result < 0 || listen(fd, SOMAXCONN) < 0) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  return fd;
+}
+
+static int run_server(const char *adventure_name, const char *address, const char *snapshot_dir) {
+  const char *filename;
+  bool cached;
+  if ((adventure = load_adventure(SV(adventure_name), &filename, &cached)) == NULL) {
+    fprintf(stderr, SV_Fmt COLOR_RESET"\n", SV_Arg(message_text(message_log_at(message_log.count - 1))));
+    return 1;
+  }
+  adventure_read_only = true;
+  server_snapshot_dir = snapshot_dir;
+  register_builtin_commands();
+
+  int listen_fd = server_listen(address);
+  if (listen_fd < 0) {
+    fprintf(stderr, "Error: could not listen on %s: %s\n", address, strerror(errno));
+    return 1;
+  }
+
+  server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event listen_event = { .events = EPOLLIN, .data.ptr = NULL };
+  if (server.epoll_fd < 0 || epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event) < 0) {
+    fprintf(stderr, "Error: epoll setup failed: %s\n", strerror(errno));
+    return 1;
+  }
+  printf("Serving \"%s\" on %s\n", filename, address);
+  fflush(stdout);
+
+  static char chunk[SERVER_READ_CHUNK];
+  struct epoll_event events[SERVER_MAX_EVENTS];
+  for (;;) {
+    int n = epoll_wait(server.epoll_fd, events, SERVER_MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "Error: epoll_wait failed: %s\n", strerror(errno));
+      return 1;
+    }
+
+    for (int i = 0; i < n; ++i) {
+      client_t *client = events[i].data.ptr;
+      if (client == NULL) {
+        client_accept(listen_fd);
+        continue;
+      }
+
+      bool alive = true;
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) alive = false;
+      if (alive && (events[i].events & EPOLLOUT)) {
+        alive = client_flush(client);
+        if (alive && client->session.exit_requested && client->output == NULL) alive = false;
+      }
+      if (alive && (events[i].events & EPOLLIN)) {
+        ssize_t count = recv(client->fd, chunk, sizeof(chunk), 0);
+        if (count > 0) alive = client_receive(client, chunk, (size_t)count);
+        else if (count == 0 || (errno != EAGAIN && errno != EINTR)) alive = false;
+      }
+      if (!alive) client_close(client);
+    }
+  }
+}
+#endif //__linux__
+
+// src/bench.c includes this file to drive the engine directly
+#ifndef TAE_NO_MAIN
+int main(int argc, char **argv) {
+  const char *program = shift_args(&argc, &argv);
+  const char *journal_path = NULL;
+  while (argc > 0) {
+    if (strcmp(argv[0], "--check") == 0) {
+      shift_args(&argc, &argv);
+      check_on_load = true;
+    } else if (strcmp(argv[0], "--compress") == 0) {
+      shift_args(&argc, &argv);
+      compress_on_load = true;
+    } else if (strcmp(argv[0], "--lazy") == 0) {
+      shift_args(&argc, &argv);
+      lazy_on_load = true;
+    } else if (strcmp(argv[0], "--journal") == 0) {
+      shift_args(&argc, &argv);
+      if (argc == 0) {
+        fprintf(stderr, "Usage: %s --journal <file> [--batch <script|->]\n", program);
+        return 1;
+      }
+      journal_path = shift_args(&argc, &argv);
+    } else {
+      break;
+    }
+  }
+
+  // A journal follows a single session, the clients of a server would
+  // interleave in it, and compile and replay run no session at all
+  if (journal_path != NULL && argc > 0 &&
+      (strcmp(argv[0], "serve") == 0 || strcmp(argv[0], "compile") == 0 || strcmp(argv[0], "replay") == 0)) {
+    fprintf(stderr, "Error: --journal only works with --batch or the interactive mode\n");
+    return 1;
+  }
+  if (journal_path != NULL) {
+    if (!journal_open(journal_path)) return 1;
+    atexit(journal_close);
+  }
+
+  if (argc > 0 && strcmp(argv[0], "compile") == 0) {
+    shift_args(&argc, &argv);
+    if (argc == 0) {
+      fprintf(stderr, "Usage: %s compile <adventure.ta>...\n", program);
+      return 1;
+    }
+    return compile_adventures(argc, argv);
+  }
+
+  if (argc > 0 && strcmp(argv[0], "serve") == 0) {
+    shift_args(&argc, &argv);
+    if (argc < 2) {
+      fprintf(stderr, "Usage: %s serve <adventure name> <port | socket path> [snapshot directory]\n", program);
+      return 1;
+    }
+#ifdef __linux__
+    return run_server(argv[0], argv[1], argc > 2 ? argv[2] : NULL);
+#else
+    fprintf(stderr, "Error: server mode needs epoll, it is only available on Linux\n");
+    return 1;
+#endif //__linux__
+  }
+
+  if (argc > 0 && strcmp(argv[0], "replay") == 0) {
+    shift_args(&argc, &argv);
+    if (argc == 0) {
+      fprintf(stderr, "Usage: %s replay <journal>\n", program);
+      return 1;
+    }
+    return run_replay(argv[0]);
+  }
+
+  if (argc > 0 && strcmp(argv[0], "--batch") == 0) {
+    shift_args(&argc, &argv);
+    if (argc == 0) {
+      fprintf(stderr, "Usage: %s --batch <script|->\n", program);
+      return 1;
+    }
+    const char *path = shift_args(&argc, &argv);
+    if (strcmp(path, "-") == 0) return run_batch(stdin);
+
+    FILE *script = fopen(path, "r");
+    if (script == NULL) {
+      fprintf(stderr, "Error: could not open %s: %s\n", path, strerror(errno));
+      return 1;
+    }
+    int result = run_batch(script);
+    fclose(script);
+    return result;
+  }
+
+  // Piped input gets the same treatment as --batch -
+#ifdef _WIN32
+  if (!_isatty(_fileno(stdin))) return run_batch(stdin);
+#else
+  if (!isatty(STDIN_FILENO)) return run_batch(stdin);
+#endif //_WIN32
+
+#ifdef SIGQUIT
+  signal(SIGQUIT, sig_handler);
+#endif
+  signal(SIGINT, sig_handler);
+#ifndef _WIN32
+  // No SA_RESTART, a resize has to interrupt the blocking read to be redrawn
+  struct sigaction winch = { .sa_handler = sigwinch_handler };
+  sigemptyset(&winch.sa_mask);
+  sigaction(SIGWINCH, &winch, NULL);
+#endif //_WIN32
+
+  register_builtin_commands();
+#ifdef TAE_STATS
+  frame_histogram = latency_histogram_new("frame");
+#endif // TAE_STATS
+  session_t session = { .current_room = NO_ROOM };
+
+  while (!session.exit_requested) {
+#ifdef _WIN32
+    get_term_size(&cols, &rows);
+#else
+    if (term_size_changed) {
+      term_size_changed = 0;
+      get_term_size(&cols, &rows);
+    }
+#endif //_WIN32
+
+    size_t save = temp_save();
+
+    STATS_BEGIN(frame_start);
+    screen_resize(cols, rows);
+    screen_compose();
+    screen_present();
+    STATS_END(frame_histogram, frame_start);
+
+#ifndef _WIN32
+    // A resize that landed while drawing would otherwise wait for the next input
+    if (term_size_changed) goto end;
+#endif //_WIN32
+#ifdef __linux__
+    // Sleep on the watched file too, a reload has to be drawn right away
+    if (watch.active && !watch_wait_for_input(&session)) goto end;
+#endif //__linux__
+    if (fgets(input_buf, INPUT_BUF_CAP, stdin) == NULL) {
+      // Interrupted by a resize, redraw and keep reading
+      if (ferror(stdin) && errno == EINTR) {
+        clearerr(stdin);
+        goto end;
+      }
+      break;
+    }
+
+    run_input_line(&session, input_buf, true);
 
-    if (input_buf[0] == '\n')
-      goto end;
-    
-    input_buf[strlen(input_buf) - 1] = '\0';
-    log_message(input_buf);
-    String_View input = SV(input_buf);
-    for (size_t i = 0; i < input.count; ++i)
-      input_buf[i] = tolower(input_buf[i]);
-    String_View cmd = sv_chop_by_predicate(&input, isspace);
-    
-    if (sv_eq(cmd, SV("exit")) || !input_buf[0])
-      break;
-    if (sv_eq(cmd, SV("help"))) {
-      log_help();
-    } else if (sv_eq(cmd, SV("clear")))
-      log_clear();
-    else if (sv_eq(cmd, SV("load"))) {
-      if (sv_eq(input, SV(""))) {
-        log_message(COLOR_RED"Error: no adventure name provided, please provide a name");
-      } else {
-        const char *filename = temp_sprintf(SV_Fmt".ta", SV_Arg(input));
-        if ((adventure_loaded = read_adventure_file(filename, &adventure))) {
-          log_message(temp_sprintf(COLOR_YELLOW"Info: adventure \"%s\" loaded successfully", filename));
-          log_message(temp_sprintf(COLOR_YELLOW"%s", adventure.rooms[(unsigned char)current_room].description));
-        }
-      }
-    } else if (sv_eq(cmd, SV("look"))) {
-      if (!adventure_loaded)
-        log_message(COLOR_RED"Error: no adventure loaded, please use the \"load\" command first");
-      else {
-        String_View direction = sv_chop_by_predicate(&input, isspace);
-        if (sv_eq(direction, SV("")))
-          log_message(temp_sprintf(COLOR_YELLOW"%s", adventure.rooms[(unsigned char)current_room].description));
-        else {
-          direction_t idx = get_direction_index(direction);
-          if (idx == INVALID_DIRECTION)
-            log_message(temp_sprintf(COLOR_RED"Error: \""SV_Fmt"\" is an invalid direction (north, south, east, west)", SV_Arg(direction)));
-          else {
-          log_message(temp_sprintf(COLOR_YELLOW"%s", adventure.rooms[(unsigned char)adventure.rooms[(unsigned char)current_room].connections[idx]].description));
-          }
-        }
-      }
-    } else
-      log_message(COLOR_RED"Error: unknown command");
-    
 end:
     memset(input_buf, '\0', INPUT_BUF_CAP);
     temp_rewind(save);
   }
 
+  printf(RESET_SCROLL_REGION);
+  printf(COLOR_RESET);
   printf(RESET_CURSOR);
   printf(CLEAR_SCREEN);
   
   return 0;
 }
+#endif // TAE_NO_MAIN